@@ -6,701 +6,1553 @@
 // --- ALPACA DISCOVERY IMPLEMENTATION ---
 // ================================================================
 
+// Replies to every "alpacadiscovery1" datagram with the fixed
+// ALPACA_DISCOVERY_RESPONSE, over IPv4 (broadcast, port 32227) and IPv6
+// (multicast ff12::a1:9aca). Both sockets are bound to every interface, so
+// a request is answered out of whichever interface (STA or AP) it came in
+// on. The network task drains everything queued on each pass, so a burst
+// of clients discovering at once is answered together. The IPv4 socket
+// also carries group commands (group_commands.cpp).
+
+#define ALPACA_DISCOVERY_MESSAGE "alpacadiscovery1"
+#define ALPACA_DISCOVERY_PACKET_SIZE 256
+
+static int discoverySocket4 = -1;
+static int discoverySocket6 = -1;
+static size_t discoveryResponseLength = 0;
+
+static int openDiscoverySocket(int family) {
+  int sock = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0) {
+    return -1;
+  }
+  int on = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+  int bound;
+  if (family == AF_INET) {
+    setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(ALPACA_DISCOVERY_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    bound = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+
+    struct ip_mreq group = {};
+    group.imr_multiaddr.s_addr = (uint32_t)FLATCAT_GROUP_MULTICAST;
+    group.imr_interface.s_addr = htonl(INADDR_ANY);
+    setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &group, sizeof(group));
+  } else {
+    setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+    struct sockaddr_in6 addr = {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port = htons(ALPACA_DISCOVERY_PORT);
+    addr.sin6_addr = in6addr_any;
+    bound = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+
+    struct ipv6_mreq group = {};
+    inet_pton(AF_INET6, ALPACA_DISCOVERY_IPV6_GROUP, &group.ipv6mr_multiaddr);
+    group.ipv6mr_interface = 0; // Default interface
+    setsockopt(sock, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, &group,
+               sizeof(group));
+  }
+  if (bound < 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
 void startAlpacaDiscovery() {
-  if (udp.begin(ALPACA_DISCOVERY_PORT)) {
-    Serial.printf("Alpaca Discovery listening on UDP port %d\n",
-                  ALPACA_DISCOVERY_PORT);
+  discoveryResponseLength = strlen(ALPACA_DISCOVERY_RESPONSE);
+  discoverySocket4 = openDiscoverySocket(AF_INET);
+  discoverySocket6 = openDiscoverySocket(AF_INET6);
+  if (discoverySocket4 >= 0) {
+    Serial.printf("Alpaca Discovery listening on UDP port %d%s\n",
+                  ALPACA_DISCOVERY_PORT,
+                  discoverySocket6 >= 0 ? " (IPv4 and IPv6)" : "");
   } else {
     Serial.println("Failed to start Alpaca Discovery UDP listener.");
   }
 }
 
+// Answers every datagram waiting on one socket
+static void drainDiscoverySocket(int sock) {
+  char packet[ALPACA_DISCOVERY_PACKET_SIZE];
+  const size_t messageLength = strlen(ALPACA_DISCOVERY_MESSAGE);
+  for (;;) {
+    struct sockaddr_storage from;
+    socklen_t fromLength = sizeof(from);
+    int len = recvfrom(sock, packet, sizeof(packet) - 1, MSG_DONTWAIT,
+                       (struct sockaddr *)&from, &fromLength);
+    if (len < 0) {
+      return; // Queue empty (EWOULDBLOCK) or a socket error
+    }
+    packet[len] = '\0';
+
+    if ((size_t)len >= messageLength &&
+        memcmp(packet, ALPACA_DISCOVERY_MESSAGE, messageLength) == 0) {
+      sendto(sock, ALPACA_DISCOVERY_RESPONSE, discoveryResponseLength, 0,
+             (struct sockaddr *)&from, fromLength);
+    } else if (sock == discoverySocket4) {
+      handleGroupPacket(packet, len);
+    }
+  }
+}
+
 void handleAlpacaDiscovery() {
-  int packetSize = udp.parsePacket();
+  if (discoverySocket4 >= 0) {
+    drainDiscoverySocket(discoverySocket4);
+  }
+  if (discoverySocket6 >= 0) {
+    drainDiscoverySocket(discoverySocket6);
+  }
+}
+
+// ----------------------------------------------------------------
+// --- mDNS-SD advertisement ---
+// For clients that cannot use the UDP broadcast (other subnets, containers)
+// the host also advertises an _alpaca._tcp service. Its TXT records carry
+// what configureddevices would return, so one mDNS query enumerates every
+// panel: "devices" plus, per device N, devN.type / devN.number / devN.uid /
+// devN.name / devN.ifver. Rebuilt whenever the settings are (re)loaded.
+// ----------------------------------------------------------------
+#define ALPACA_MDNS_TXT_PER_DEVICE 5
+
+static bool alpacaMdnsStarted = false;
+
+void updateAlpacaMdnsRecords() {
+  if (!alpacaMdnsStarted) {
+    return; // Not advertising yet; startAlpacaMdns() calls back in
+  }
+  static const int maxItems =
+      3 + MAX_COVER_CALIBRATORS * ALPACA_MDNS_TXT_PER_DEVICE;
+  char keys[maxItems][16];
+  char values[maxItems][64];
+  mdns_txt_item_t items[maxItems];
+  int n = 0;
+
+  auto add = [&](const char *value) {
+    strlcpy(values[n], value, sizeof(values[n]));
+    items[n].key = keys[n];
+    items[n].value = values[n];
+    n++;
+  };
+  snprintf(keys[n], sizeof(keys[n]), "port");
+  add("80");
+  snprintf(keys[n], sizeof(keys[n]), "manufacturer");
+  add("orangemaze");
+  snprintf(keys[n], sizeof(keys[n]), "devices");
+  add(String(coverCalibratorCount).c_str());
+
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    char uniqueID[48];
+    formatDeviceUniqueID(i, uniqueID, sizeof(uniqueID));
+    snprintf(keys[n], sizeof(keys[n]), "dev%d.type", i);
+    add("CoverCalibrator");
+    snprintf(keys[n], sizeof(keys[n]), "dev%d.number", i);
+    add(String(i).c_str());
+    snprintf(keys[n], sizeof(keys[n]), "dev%d.uid", i);
+    add(uniqueID);
+    snprintf(keys[n], sizeof(keys[n]), "dev%d.name", i);
+    add(currentSettings.title[i].c_str());
+    snprintf(keys[n], sizeof(keys[n]), "dev%d.ifver", i);
+    add("2"); // ICoverCalibratorV2
+  }
+  mdns_service_txt_set("_alpaca", "_tcp", items, n); // Replaces the set
+}
+
+/**
+ * @brief Adds the _alpaca._tcp service. Call after MDNS.begin().
+ */
+void startAlpacaMdns() {
+  if (!MDNS.addService("alpaca", "tcp", 80)) {
+    return;
+  }
+  alpacaMdnsStarted = true;
+  updateAlpacaMdnsRecords();
+}
 
-  if (packetSize) {
-    char incomingPacket[255];
-    int len = udp.read(incomingPacket, 255);
-    incomingPacket[len] = 0;
+// ================================================================
+// --- ALPACA JSON UTILITY ---
+// ================================================================
 
-    // Check for 'alpacadiscovery1'
-    if (strstr(incomingPacket, "alpacadiscovery1") != NULL) {
-      Serial.println("Alpaca Discovery Request received. Sending response.");
+AlpacaResponse::AlpacaResponse(long clientTransactionID, int errorNum,
+                               const char *errorMsg)
+    : len(0), depth(0), needComma(0), isObject(0), overflow(false),
+      finished(false) {
+  raw("{\"ClientTransactionID\":");
+  number(clientTransactionID);
+  raw(",\"ServerTransactionID\":");
+  number(serverTransactionID++);
+  raw(",\"ErrorNumber\":");
+  number((long)errorNum);
+  raw(",\"ErrorMessage\":");
+  quoted(errorMsg);
+  needComma = 1; // Everything after the header is preceded by a comma
+}
 
-      IPAddress remoteIP = udp.remoteIP();
-      int remotePort = udp.remotePort();
+AlpacaResponse::AlpacaResponse(TemplateMode)
+    : len(0), depth(0), needComma(0), isObject(0), overflow(false),
+      finished(false) {
+  raw("\"ErrorNumber\":0,\"ErrorMessage\":\"\"");
+  needComma = 1;
+}
 
-      udp.beginPacket(remoteIP, remotePort);
-      udp.write((uint8_t *)ALPACA_DISCOVERY_RESPONSE,
-                strlen(ALPACA_DISCOVERY_RESPONSE));
-      udp.endPacket();
+void AlpacaResponse::raw(const char *s, size_t n) {
+  // Always leave room to close every open container, the envelope and the
+  // terminator
+  if (overflow || len + n + depth + 2 > sizeof(buf)) {
+    overflow = true;
+    return;
+  }
+  memcpy(buf + len, s, n);
+  len += n;
+}
 
-      Serial.println("Response sent.");
+void AlpacaResponse::raw(const char *s) { raw(s, strlen(s)); }
+
+void AlpacaResponse::rawChar(char c) { raw(&c, 1); }
+
+void AlpacaResponse::quoted(const char *s) {
+  rawChar('"');
+  if (s == nullptr)
+    s = "";
+  while (*s) {
+    // Copy the longest run that needs no escaping in one go
+    const char *run = s;
+    while (*s && *s != '"' && *s != '\\' && (uint8_t)*s >= 0x20)
+      s++;
+    raw(run, s - run);
+    if (!*s)
+      break;
+    char esc[7];
+    switch (*s) {
+    case '"':
+      raw("\\\"");
+      break;
+    case '\\':
+      raw("\\\\");
+      break;
+    case '\n':
+      raw("\\n");
+      break;
+    case '\r':
+      raw("\\r");
+      break;
+    case '\t':
+      raw("\\t");
+      break;
+    default:
+      snprintf(esc, sizeof(esc), "\\u%04x", (uint8_t)*s);
+      raw(esc);
+      break;
     }
+    s++;
   }
+  rawChar('"');
 }
 
-// ================================================================
-// --- ALPACA JSON UTILITY ---
-// ================================================================
+void AlpacaResponse::number(long v) {
+  char tmp[12];
+  int n = snprintf(tmp, sizeof(tmp), "%ld", v);
+  raw(tmp, n);
+}
+
+void AlpacaResponse::number(double v) {
+  if (isnan(v) || isinf(v)) {
+    raw("null"); // JSON has no representation for these
+    return;
+  }
+  char tmp[24];
+  int n = snprintf(tmp, sizeof(tmp), "%.10g", v);
+  raw(tmp, n);
+}
+
+void AlpacaResponse::separator() {
+  if (needComma & (1 << depth))
+    rawChar(',');
+  needComma |= (1 << depth);
+}
+
+void AlpacaResponse::key(const char *name) {
+  separator();
+  quoted(name);
+  rawChar(':');
+}
+
+void AlpacaResponse::open(char c) {
+  // The bracket itself, then room for one more closer on top of the
+  // existing ones, the envelope and the terminator. On failure depth stays
+  // put so c_str() never closes something that was not written.
+  if (overflow || depth >= 7 || len + 1 + depth + 3 > sizeof(buf)) {
+    overflow = true; // Out of room, or deeper than we will ever need
+    return;
+  }
+  rawChar(c);
+  depth++;
+  needComma &= ~(1 << depth);
+  if (c == '{')
+    isObject |= (1 << depth);
+  else
+    isObject &= ~(1 << depth);
+}
+
+void AlpacaResponse::close(char c) {
+  if (depth > 0)
+    depth--;
+  rawChar(c);
+}
+
+void AlpacaResponse::value(bool v) {
+  key("Value");
+  raw(v ? "true" : "false");
+}
+
+void AlpacaResponse::value(int v) { value((long)v); }
+
+void AlpacaResponse::value(long v) {
+  key("Value");
+  number(v);
+}
+
+void AlpacaResponse::value(double v) {
+  key("Value");
+  number(v);
+}
+
+void AlpacaResponse::value(const char *v) {
+  key("Value");
+  quoted(v);
+}
+
+void AlpacaResponse::beginValueArray() {
+  key("Value");
+  open('[');
+}
+
+void AlpacaResponse::beginValueObject() {
+  key("Value");
+  open('{');
+}
+
+void AlpacaResponse::add(bool v) {
+  separator();
+  raw(v ? "true" : "false");
+}
+
+void AlpacaResponse::add(int v) { add((long)v); }
+
+void AlpacaResponse::add(long v) {
+  separator();
+  number(v);
+}
+
+void AlpacaResponse::add(double v) {
+  separator();
+  number(v);
+}
+
+void AlpacaResponse::add(const char *v) {
+  separator();
+  quoted(v);
+}
+
+void AlpacaResponse::beginObject() {
+  separator();
+  open('{');
+}
+
+void AlpacaResponse::endObject() { close('}'); }
+
+void AlpacaResponse::beginArray() {
+  separator();
+  open('[');
+}
+
+void AlpacaResponse::endArray() { close(']'); }
 
-// Generates a standard Alpaca JSON response
-String createAlpacaJSON(long clientTransactionIDToEcho, int errorNum,
-                        String errorMsg, const char *valueType, String value) {
-  StaticJsonDocument<512> doc;
-
-  doc["ClientTransactionID"] = clientTransactionIDToEcho;
-  doc["ServerTransactionID"] = serverTransactionID++;
-  doc["ErrorNumber"] = errorNum;
-  doc["ErrorMessage"] = errorMsg;
-
-  if (errorNum == 0) {
-    if (valueType == "string") {
-      doc["Value"] = value;
-    } else if (valueType == "bool") {
-      doc["Value"] =
-          (value.equalsIgnoreCase("true") || value.equalsIgnoreCase("1"));
-    } else if (valueType == "int") {
-      doc["Value"] = value.toInt();
-    } else if (valueType == "double") {
-      doc["Value"] = value.toDouble();
-    } else {
-      doc["Value"] = value; // Default to string if type is unknown
+void AlpacaResponse::member(const char *name, bool v) {
+  key(name);
+  raw(v ? "true" : "false");
+}
+
+void AlpacaResponse::member(const char *name, int v) {
+  member(name, (long)v);
+}
+
+void AlpacaResponse::member(const char *name, long v) {
+  key(name);
+  number(v);
+}
+
+void AlpacaResponse::member(const char *name, double v) {
+  key(name);
+  number(v);
+}
+
+void AlpacaResponse::member(const char *name, const char *v) {
+  key(name);
+  quoted(v);
+}
+
+const char *AlpacaResponse::c_str() {
+  if (!finished && overflow) {
+    // Truncated: send() discards this anyway, just keep it a C string
+    buf[len] = '\0';
+    finished = true;
+  } else if (!finished) {
+    // Close anything the caller left open, then the envelope itself.
+    // raw() and open() always reserve room for these, so they cannot fail.
+    while (depth > 0) {
+      buf[len++] = (isObject & (1 << depth)) ? '}' : ']';
+      depth--;
     }
+    buf[len++] = '}';
+    buf[len] = '\0';
+    finished = true;
   }
+  return buf;
+}
+
+void AlpacaResponse::send(int httpCode) {
+  c_str();
+  if (overflow) {
+    // Should never happen with the fixed response shapes we produce
+    http->send(500, "text/plain", "Alpaca response too large.");
+    return;
+  }
+  http->send(httpCode, "application/json", buf, len);
+}
+
+// --- Shorthands for the common single-value responses ---
+void sendAlpacaOK(long clientTransactionID) {
+  AlpacaResponse(clientTransactionID).send();
+}
+
+void sendAlpacaError(int httpCode, long clientTransactionID, int errorNum,
+                     const char *errorMsg) {
+  AlpacaResponse(clientTransactionID, errorNum, errorMsg).send(httpCode);
+}
 
-  String json;
-  serializeJson(doc, json);
-  return json;
+void sendAlpacaValue(long clientTransactionID, bool value) {
+  AlpacaResponse response(clientTransactionID);
+  response.value(value);
+  response.send();
+}
+
+void sendAlpacaValue(long clientTransactionID, int value) {
+  AlpacaResponse response(clientTransactionID);
+  response.value(value);
+  response.send();
+}
+
+void sendAlpacaValue(long clientTransactionID, const char *value) {
+  AlpacaResponse response(clientTransactionID);
+  response.value(value);
+  response.send();
 }
 
 // ================================================================
-// --- ALPACA MANAGEMENT API HANDLERS ---
+// --- ALPACA RESPONSE CACHE ---
 // ================================================================
 
-// Implements /management/v1/apiversions
-void handleAlpacaAPIVersions(long clientID) {
-  StaticJsonDocument<128> doc;
-  doc["ClientTransactionID"] = clientID;
-  doc["ServerTransactionID"] = serverTransactionID++;
-  doc["ErrorNumber"] = 0;
-  doc["ErrorMessage"] = "";
+#define ALPACA_CACHE_POOL_SIZE 1536
 
-  JsonArray versions = doc.createNestedArray("Value");
-  versions.add(1);
+static char alpacaCachePool[ALPACA_CACHE_POOL_SIZE];
+static uint16_t alpacaCacheOffset[ALPACA_CACHED_COUNT];
+static uint16_t alpacaCacheLength[ALPACA_CACHED_COUNT];
+static bool alpacaCacheValid = false;
 
-  String json;
-  serializeJson(doc, json);
+static void buildCachedCapability(AlpacaResponse &response) {
+  response.value(true);
+}
 
-  server.sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
-  server.send(200, "application/json", json.c_str());
+static void buildCachedInterfaceVersion(AlpacaResponse &response) {
+  response.value(2);
 }
 
-// Implements /management/v1/description
-void handleAlpacaDescription(long clientID) {
-  StaticJsonDocument<256> doc;
-  doc["ClientTransactionID"] = clientID;
-  doc["ServerTransactionID"] = serverTransactionID++;
-  doc["ErrorNumber"] = 0;
-  doc["ErrorMessage"] = "";
+static void buildCachedDescription(AlpacaResponse &response, int device) {
+  response.value(currentSettings.title[device].c_str());
+}
 
-  // Value: A single JSON Object {}
-  JsonObject value = doc.createNestedObject("Value");
+static void buildCachedDriverInfo(AlpacaResponse &response) {
+  response.value("FlatCat CoverCalibrator V2.0 |"
+                 "ASCOM Alpaca Driver by Orangemaze |"
+                 "Compiled: " __DATE__ " " __TIME__ " |"
+                 "Hardware: Flat Panel/Lens Cap");
+}
 
-  value["ServerName"] = currentSettings.hostname;
-  value["Manufacturer"] = "orangemaze";
-  value["ManufacturerVersion"] = "1.0.0"; // Corrected for compliance
-  value["Version"] = "1.0.0";
-  value["Location"] = "The Observatory";
+static void buildCachedDriverVersion(AlpacaResponse &response) {
+  response.value("2.0.0");
+}
 
-  String json;
-  serializeJson(doc, json);
+static void buildCachedMaxBrightness(AlpacaResponse &response) {
+  response.value(maxBrightness);
+}
 
-  server.sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
-  server.send(200, "application/json", json.c_str());
+// Names handled by the 'action' member (handleCoverCalibratorAction)
+static const char *const alpacaActionNames[] = {
+    "RecallPreset", // Parameters: preset name
+    "ListPresets",  // Value: JSON array of the presets
+    "SavePreset",   // Parameters: "name,brightness[,rampMs[,dwellMs]]"
+    "DeletePreset", // Parameters: preset name
+    "StartSequence",  // Parameters: "brightness,rampMs,holdMs[,open|close];..."
+    "AbortSequence",
+    "SequenceStatus", // Value: JSON object with the progress
+    "CaptureLightReference", // Current light becomes the regulator target
+};
+
+static void buildCachedSupportedActions(AlpacaResponse &response) {
+  response.beginValueArray();
+  for (const char *name : alpacaActionNames) {
+    response.add(name);
+  }
+  response.endArray();
 }
 
-// Implements /management/v1/configureddevices
-void handleAlpacaConfiguredDevices(long clientID) {
-  StaticJsonDocument<512> doc;
-  doc["ClientTransactionID"] = clientID;
-  doc["ServerTransactionID"] = serverTransactionID++;
-  doc["ErrorNumber"] = 0;
-  doc["ErrorMessage"] = "";
+static void buildCachedAPIVersions(AlpacaResponse &response) {
+  response.beginValueArray();
+  response.add(1);
+  response.endArray();
+}
 
+static void buildCachedServerDescription(AlpacaResponse &response) {
+  // Value: A single JSON Object {}
+  response.beginValueObject();
+  response.member("ServerName", currentSettings.hostname.c_str());
+  response.member("Manufacturer", "orangemaze");
+  response.member("ManufacturerVersion", "1.0.0"); // Corrected for compliance
+  response.member("Version", "1.0.0");
+  response.member("Location", "The Observatory");
+  response.endObject();
+}
+
+static void buildCachedConfiguredDevices(AlpacaResponse &response) {
   // Value: An Array of JSON Objects []
-  JsonArray confarray = doc.createNestedArray("Value");
+  response.beginValueArray();
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    char uniqueID[48];
+    formatDeviceUniqueID(i, uniqueID, sizeof(uniqueID));
+    response.beginObject();
+    response.member("DeviceName", currentSettings.title[i].c_str());
+    response.member("DeviceType", "CoverCalibrator");
+    response.member("DeviceNumber", i);
+    response.member("UniqueID", uniqueID);
+    response.endObject();
+  }
+  response.endArray();
+}
 
-  // 'dev' is defined here
-  JsonObject dev = confarray.createNestedObject();
+static void buildCachedResponse(int which, AlpacaResponse &response) {
+  if (which >= ALPACA_CACHED_DESCRIPTION &&
+      which <= ALPACA_CACHED_DESCRIPTION_LAST) {
+    buildCachedDescription(response, which - ALPACA_CACHED_DESCRIPTION);
+    return;
+  }
+  switch (which) {
+  case ALPACA_CACHED_CAPABILITY:
+    buildCachedCapability(response);
+    break;
+  case ALPACA_CACHED_INTERFACE_VERSION:
+    buildCachedInterfaceVersion(response);
+    break;
+  case ALPACA_CACHED_DRIVER_INFO:
+    buildCachedDriverInfo(response);
+    break;
+  case ALPACA_CACHED_DRIVER_VERSION:
+    buildCachedDriverVersion(response);
+    break;
+  case ALPACA_CACHED_MAX_BRIGHTNESS:
+    buildCachedMaxBrightness(response);
+    break;
+  case ALPACA_CACHED_SUPPORTED_ACTIONS:
+    buildCachedSupportedActions(response);
+    break;
+  case ALPACA_CACHED_API_VERSIONS:
+    buildCachedAPIVersions(response);
+    break;
+  case ALPACA_CACHED_SERVER_DESCRIPTION:
+    buildCachedServerDescription(response);
+    break;
+  case ALPACA_CACHED_CONFIGURED_DEVICES:
+    buildCachedConfiguredDevices(response);
+    break;
+  }
+}
 
-  dev["DeviceName"] = currentSettings.title1;
-  dev["DeviceType"] = "CoverCalibrator";
-  dev["DeviceNumber"] = 0;
+void invalidateAlpacaResponseCache() { alpacaCacheValid = false; }
+
+void buildAlpacaResponseCache() {
+  size_t used = 0;
+  for (int i = 0; i < ALPACA_CACHED_COUNT; i++) {
+    AlpacaResponse response(AlpacaResponse::TEMPLATE);
+    buildCachedResponse(i, response);
+    const char *body = response.c_str();
+    size_t n = response.length();
+    if (response.overflowed() || used + n > sizeof(alpacaCachePool)) {
+      // Leave it empty; sendCachedAlpacaResponse() reports the failure
+      n = 0;
+    }
+    memcpy(alpacaCachePool + used, body, n);
+    alpacaCacheOffset[i] = used;
+    alpacaCacheLength[i] = n;
+    used += n;
+  }
+  alpacaCacheValid = true;
+}
 
-  // FIX: Using the global UniqueID (which you were setting to "1000" before)
-  dev["UniqueID"] = deviceUniqueID;
+void sendCachedAlpacaResponse(AlpacaCachedResponse which,
+                              long clientTransactionID) {
+  if (!alpacaCacheValid) {
+    buildAlpacaResponseCache();
+  }
+  size_t tailLength = alpacaCacheLength[which];
+  if (tailLength == 0) {
+    http->send(500, "text/plain", "Alpaca response too large.");
+    return;
+  }
 
-  String json;
-  serializeJson(doc, json);
+  // Patch the two transaction IDs in front of the pre-serialized tail
+  char body[ALPACA_RESPONSE_BUFFER_SIZE];
+  int n = snprintf(body, sizeof(body),
+                   "{\"ClientTransactionID\":%ld,\"ServerTransactionID\":%ld,",
+                   clientTransactionID, serverTransactionID++);
+  if (n < 0 || n + tailLength > sizeof(body)) {
+    http->send(500, "text/plain", "Alpaca response too large.");
+    return;
+  }
+  memcpy(body + n, alpacaCachePool + alpacaCacheOffset[which], tailLength);
+  http->send(200, "application/json", body, n + tailLength);
+}
 
-  server.sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
-  server.send(200, "application/json", json.c_str());
+// ================================================================
+// --- ALPACA MANAGEMENT API HANDLERS ---
+// ================================================================
+
+// Implements /management/v1/apiversions
+void handleAlpacaAPIVersions(long clientID) {
+  http->sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
+  sendCachedAlpacaResponse(ALPACA_CACHED_API_VERSIONS, clientID);
+}
+
+// Implements /management/v1/description
+void handleAlpacaDescription(long clientID) {
+  http->sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
+  sendCachedAlpacaResponse(ALPACA_CACHED_SERVER_DESCRIPTION, clientID);
+}
+
+// Implements /management/v1/configureddevices
+void handleAlpacaConfiguredDevices(long clientID) {
+  http->sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
+  sendCachedAlpacaResponse(ALPACA_CACHED_CONFIGURED_DEVICES, clientID);
 }
 
 // Implements /management/v1/supporteddevices (Uses configureddevices logic)
 void handleAlpacaSupportedDevices() { handleAlpacaConfiguredDevices(0); }
 
 // ================================================================
-// --- ALPACA DEVICE API HANDLERS ---
+// --- ALPACA PARAMETER PARSING ---
 // ================================================================
 
-// Implements the specific methods for the CoverCalibrator device
-void handleAlpacaCoverCalibrator(long clientID, long transactionID,
-                                 int deviceNum) {
-  String uri = server.uri();
-  String method = server.method() == HTTP_GET ? "GET" : "PUT";
-  int start = uri.indexOf("covercalibrator/");
-  if (start != -1) {
-    start += strlen("covercalibrator/");
-    int end = uri.indexOf('/', start);
-    if (end == -1)
-      end = uri.length();
-
-    String devNumStr = uri.substring(start, end);
-
-    // --- NEW VALIDATION FIX ---
-    // 1. Check if the string contains non-numeric characters (like 'A')
-    if (!isNumeric(devNumStr)) {
-      String errorMsg = "Invalid device number format. Must be numeric.";
-      String responseJson =
-          createAlpacaJSON(transactionID, 0x100, errorMsg, "", "");
-      server.send(400, "application/json", responseJson.c_str());
-      return; // EXIT immediately for non-numeric input
+static int hexDigitValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = (char)tolower((unsigned char)c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+// Copies a parameter value into 'out' as a C string, decoding it when it
+// still carries URL encoding. Returns the decoded length (truncated to fit).
+size_t copyAlpacaParam(const AlpacaParamValue &value, char *out,
+                       size_t outSize, bool *truncated) {
+  size_t n = 0;
+  size_t i = 0;
+  if (truncated)
+    *truncated = value.length > 0;
+  if (outSize == 0)
+    return 0;
+  for (; value.data && i < value.length && n + 1 < outSize; i++) {
+    char c = value.data[i];
+    if (value.urlEncoded && c == '+') {
+      c = ' ';
+    } else if (value.urlEncoded && c == '%' && i + 2 < value.length &&
+               hexDigitValue(value.data[i + 1]) >= 0 &&
+               hexDigitValue(value.data[i + 2]) >= 0) {
+      c = (char)(hexDigitValue(value.data[i + 1]) * 16 +
+                 hexDigitValue(value.data[i + 2]));
+      i += 2;
     }
+    out[n++] = c;
+  }
+  out[n] = '\0';
+  if (truncated)
+    *truncated = value.data && i < value.length; // Ran out of room
+  return n;
+}
 
-    // 2. Now safely convert to int
-    int requestedDevNum = devNumStr.toInt();
-
-    // 3. Check if the number is the supported device (Device 0)
-    if (requestedDevNum != 0) {
-      String errorMsg = "Invalid device number: " + devNumStr +
-                        ". Only device 0 is configured.";
-      String responseJson =
-          createAlpacaJSON(transactionID, 0x100, errorMsg, "", "");
-      server.send(400, "application/json", responseJson.c_str());
-      return; // EXIT immediately for non-zero numbers
+// Parses a whole value as a base-10 integer; false if anything else is there
+static bool parseAlpacaInteger(const AlpacaParamValue &value, long &result) {
+  char digits[24];
+  if (value.length == 0 || value.length >= sizeof(digits))
+    return false;
+  size_t n = copyAlpacaParam(value, digits, sizeof(digits));
+  char *end = nullptr;
+  result = strtol(digits, &end, 10);
+  return n > 0 && end == digits + n;
+}
+
+static bool paramNameIs(const char *name, size_t nameLength,
+                        const char *expected) {
+  return strlen(expected) == nameLength &&
+         strncasecmp(name, expected, nameLength) == 0;
+}
+
+// Records one name/value pair if it is an Alpaca parameter we recognise
+static void collectAlpacaParam(const char *name, size_t nameLength,
+                               const AlpacaParamValue &value,
+                               AlpacaParams &params) {
+  switch (nameLength) {
+  case 6:
+    if (paramNameIs(name, nameLength, "Action"))
+      params.action = value;
+    break;
+  case 8:
+    if (paramNameIs(name, nameLength, "ClientID")) {
+      params.hasClientID = true;
+      parseAlpacaInteger(value, params.clientID);
+    }
+    break;
+  case 10:
+    if (paramNameIs(name, nameLength, "Brightness")) {
+      params.hasBrightness = true;
+      params.brightnessValid = parseAlpacaInteger(value, params.brightness);
+    } else if (paramNameIs(name, nameLength, "Parameters")) {
+      params.parameters = value;
     }
+    break;
+  case 19:
+    if (paramNameIs(name, nameLength, "ClientTransactionID")) {
+      params.hasClientTransactionID = true;
+      params.clientTransactionIDValid =
+          parseAlpacaInteger(value, params.clientTransactionID) &&
+          params.clientTransactionID != 0;
+    }
+    break;
   }
+}
+
+// Walks "name=value&name=value" text (a raw query string or a
+// form-encoded body) once, without copying it. Adds to 'params', so zero it
+// before the first call.
+void parseAlpacaParamString(const char *text, size_t length,
+                            AlpacaParams &params) {
+  const char *end = text + length;
+  while (text < end) {
+    const char *pairEnd = (const char *)memchr(text, '&', end - text);
+    if (pairEnd == nullptr)
+      pairEnd = end;
+    const char *eq = (const char *)memchr(text, '=', pairEnd - text);
+    const char *nameEnd = eq ? eq : pairEnd;
+
+    AlpacaParamValue value;
+    value.data = eq ? eq + 1 : pairEnd;
+    value.length = pairEnd - value.data;
+    value.urlEncoded = true;
+    collectAlpacaParam(text, nameEnd - text, value, params);
+
+    text = pairEnd + 1;
+  }
+}
 
-  // --- 1. Handle 'connected' ---
-  if (uri.indexOf("connected") != -1) {
-    String responseJson =
-        createAlpacaJSON(transactionID, 0, "", "bool", "true");
-    if (method == "GET") {
-      server.send(200, "application/json", responseJson.c_str());
-    } else { // PUT
-      server.send(200, "application/json", responseJson.c_str());
+// Collects the parameters of the current WebServer request in one pass over
+// its argument list (query string and form body, already decoded)
+void parseAlpacaServerArgs(AlpacaParams &params) {
+  memset(&params, 0, sizeof(params));
+  for (int i = 0; i < server.args(); i++) {
+    const String &name = server.argNameRef(i);
+    const String &value = server.argValueRef(i);
+    if (name == "plain") {
+      // A PUT body WebServer did not recognise as a form: tokenize it here
+      parseAlpacaParamString(value.c_str(), value.length(), params);
+      continue;
     }
+    AlpacaParamValue view = {value.c_str(), value.length(), false};
+    collectAlpacaParam(name.c_str(), name.length(), view, params);
+  }
+}
+
+// ================================================================
+// --- ALPACA DEVICE API HANDLERS ---
+// ================================================================
+
+// A device API call, parsed once from
+// /api/v1/{devicetype}/{devicenumber}/{member}
+struct AlpacaRequest {
+  long clientID;
+  long transactionID;
+  int deviceNumber;
+  bool isPut;
+  const AlpacaParams *params;
+};
+
+typedef void (*AlpacaMemberHandler)(const AlpacaRequest &req);
+
+struct AlpacaMemberEntry {
+  const char *name; // Lowercase member name as it appears in the URI
+  AlpacaMemberHandler handler;
+};
+
+// --- 'connected' (GET/PUT) ---
+static void handleCoverCalibratorConnected(const AlpacaRequest &req) {
+  sendAlpacaValue(req.transactionID, true);
+}
+
+// --- 'coverstate' Property (GET only) ---
+static void handleCoverCalibratorCoverState(const AlpacaRequest &req) {
+  if (req.isPut) {
+    http->send(400, "text/plain", "Error: CoverState is a GET-only property.");
     return;
   }
+  DeviceSnapshot state;
+  readDeviceSnapshot(req.deviceNumber, state);
+  sendAlpacaValue(req.transactionID, state.coverState);
+}
 
-  // --- 2. Handle 'coverstate' Property (GET only) ---
-  if (uri.indexOf("coverstate") != -1) {
-    if (method == "GET") {
-      String stateValue = String(coverState_1);
+// --- 'calibratorstate' Property (GET only) ---
+static void handleCoverCalibratorCalibratorState(const AlpacaRequest &req) {
+  if (req.isPut) {
+    // Use 0x403 (1027) InvalidOperationException and 400 Bad Request status.
+    sendAlpacaError(400, req.transactionID, 0x403,
+                    "CalibratorState is a GET-only property.");
+    return;
+  }
+  DeviceSnapshot state;
+  readDeviceSnapshot(req.deviceNumber, state);
+  sendAlpacaValue(req.transactionID, state.calibratorState);
+}
 
-      // CRITICAL FIX: Ensure transactionID is used to echo the CTID
-      String responseJson =
-          createAlpacaJSON(transactionID, 0, "", "int", stateValue);
+// --- 'brightness' Property (GET only; set through CalibratorOn) ---
+static void handleCoverCalibratorBrightness(const AlpacaRequest &req) {
+  if (req.isPut) {
+    sendAlpacaError(400, req.transactionID, 0x403,
+                    "Brightness is a GET-only property.");
+    return;
+  }
+  DeviceSnapshot state;
+  readDeviceSnapshot(req.deviceNumber, state);
+  sendAlpacaValue(req.transactionID, state.brightness);
+}
 
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      // Reject PUT request
-      server.send(400, "text/plain",
-                  "Error: CoverState is a GET-only property.");
-    }
+// --- 'maxbrightness' Property (GET only) ---
+static void handleCoverCalibratorMaxBrightness(const AlpacaRequest &req) {
+  if (req.isPut) {
+    http->send(400, "text/plain",
+                "Error: MaxBrightness is a GET-only property.");
     return;
   }
-  // --- 3. Handle 'calibratorstate' Property (GET only) ---
-  if (uri.indexOf("calibratorstate") != -1) {
-    if (method == "GET") {
-      // Logic for GET (correctly returning the integer value)
-      String stateValue = String(calibratorState_1);
-      String responseJson =
-          createAlpacaJSON(transactionID, 0, "", "int", stateValue);
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      // FIX: Explicitly handle and reject the unsupported PUT method.
-      String errorMsg = "CalibratorState is a GET-only property.";
-
-      // Use 0x403 (1027) InvalidOperationException and 400 Bad Request status.
-      String responseJson =
-          createAlpacaJSON(transactionID, 0x403, errorMsg, "", "");
-      server.send(400, "application/json", responseJson.c_str());
-    }
+  sendCachedAlpacaResponse(ALPACA_CACHED_MAX_BRIGHTNESS, req.transactionID);
+}
+
+// --- 'interfaceversion' Property (GET only) ---
+static void handleCoverCalibratorInterfaceVersion(const AlpacaRequest &req) {
+  if (req.isPut) {
+    http->send(400, "text/plain",
+                "Error: InterfaceVersion is a GET-only property.");
     return;
   }
-  if (uri.indexOf("brightness") != -1) {
-    if (method == "GET") {
-      // currentDimmerValue_1 is the global variable (0 to MaxBrightness)
-      String value = String(currentDimmerValue_1);
-      String responseJson =
-          createAlpacaJSON(transactionID, 0, "", "int", value);
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      // Brightness is GET-only; the PUT command is handled by CalibratorOn
-      String errorMsg = "Brightness is a GET-only property.";
-      String responseJson =
-          createAlpacaJSON(transactionID, 0x403, errorMsg, "", "");
-      server.send(400, "application/json", responseJson.c_str());
-    }
+  sendCachedAlpacaResponse(ALPACA_CACHED_INTERFACE_VERSION, req.transactionID);
+}
+
+// --- 'description' Property (GET only) ---
+static void handleCoverCalibratorDescription(const AlpacaRequest &req) {
+  if (req.isPut) {
+    http->send(400, "text/plain",
+                "Error: Description is a GET-only property.");
     return;
   }
-  // --- 4. Handle 'maxbrightness' Property (GET only) ---
-  if (uri.indexOf("maxbrightness") != -1) {
-    if (method == "GET") {
-      String responseJson =
-          createAlpacaJSON(clientID, 0, "", "int", String(maxBrightness));
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      server.send(400, "text/plain",
-                  "Error: MaxBrightness is a GET-only property.");
-    }
+  sendCachedAlpacaResponse(
+      (AlpacaCachedResponse)(ALPACA_CACHED_DESCRIPTION + req.deviceNumber),
+      req.transactionID);
+}
+
+// --- 'supportedactions' Property (GET only) ---
+static void handleCoverCalibratorSupportedActions(const AlpacaRequest &req) {
+  if (req.isPut) {
+    http->send(400, "text/plain", "GET only");
     return;
   }
+  sendCachedAlpacaResponse(ALPACA_CACHED_SUPPORTED_ACTIONS, req.transactionID);
+}
 
-  // --- 5. Handle 'interfaceversion' Property (GET only) ---
-  if (uri.indexOf("interfaceversion") != -1) {
-    if (method == "GET") {
-      String responseJson = createAlpacaJSON(transactionID, 0, "", "int", "2");
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      server.send(400, "text/plain",
-                  "Error: InterfaceVersion is a GET-only property.");
-    }
+// --- 'canopen' / 'canclose' / 'canhalt' Capabilities (GET only) ---
+// These let NINA enable its cover buttons.
+static void handleCoverCalibratorCapability(const AlpacaRequest &req) {
+  if (req.isPut) {
+    http->send(400, "text/plain", "GET only");
     return;
   }
+  sendCachedAlpacaResponse(ALPACA_CACHED_CAPABILITY, req.transactionID);
+}
 
-  // --- 6. Handle 'description' Property (GET only) ---
-  if (uri.indexOf("description") != -1) {
-    if (method == "GET") {
-      String responseJson = createAlpacaJSON(transactionID, 0, "", "string",
-                                             currentSettings.title1);
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      server.send(400, "text/plain",
-                  "Error: Description is a GET-only property.");
-    }
+// --- 'covermoving' Property (GET only) ---
+static void handleCoverCalibratorCoverMoving(const AlpacaRequest &req) {
+  if (req.isPut) {
+    http->send(400, "text/plain", "GET only");
+    return;
+  }
+  DeviceSnapshot state;
+  readDeviceSnapshot(req.deviceNumber, state);
+  sendAlpacaValue(req.transactionID, state.coverState == coverMoving);
+}
+
+// --- 'calibratorchanging' Property (GET only) ---
+static void handleCoverCalibratorCalibratorChanging(const AlpacaRequest &req) {
+  if (req.isPut) {
+    http->send(400, "text/plain", "GET only");
     return;
   }
+  DeviceSnapshot state;
+  readDeviceSnapshot(req.deviceNumber, state);
+  sendAlpacaValue(req.transactionID, state.calibratorChanging);
+}
 
-  // --- NEW: SupportedStrings / Capabilities to enable NINA Buttons ---
+// The control task did not take the command within CONTROL_REPLY_TIMEOUT_MS
+static void sendControlBusy(const AlpacaRequest &req) {
+  // 0x500 is the first driver-specific ASCOM error number
+  sendAlpacaError(503, req.transactionID, 0x500,
+                  "Hardware controller is busy, please retry.");
+}
 
-  // supportedactions
-  if (uri.indexOf("supportedactions") != -1) {
-    if (method == "GET") {
-      StaticJsonDocument<200> doc;
-      doc["ClientTransactionID"] = transactionID;
-      doc["ServerTransactionID"] = serverTransactionID++;
-      doc["ErrorNumber"] = 0;
-      doc["ErrorMessage"] = "";
-      JsonArray val = doc.createNestedArray("Value");
-      String output;
-      serializeJson(doc, output);
-      server.send(200, "application/json", output);
-    } else {
-      server.send(400, "text/plain", "GET only");
-    }
+// --- 'calibratoron' Method (PUT) ---
+static void handleCoverCalibratorCalibratorOn(const AlpacaRequest &req) {
+  if (!req.isPut) {
+    http->send(400, "text/plain", "CalibratorOn must be a PUT request.");
     return;
   }
-  // canopen
-  if (uri.indexOf("canopen") != -1) {
-    if (method == "GET") {
-      server.send(
-          200, "application/json",
-          createAlpacaJSON(transactionID, 0, "", "bool", "true").c_str());
-    } else {
-      server.send(400, "text/plain", "GET only");
-    }
+  if (!req.params->hasBrightness) {
+    http->send(400, "text/plain",
+                "Missing Brightness parameter for CalibratorOn.");
     return;
   }
-  // canclose
-  if (uri.indexOf("canclose") != -1) {
-    if (method == "GET") {
-      server.send(
-          200, "application/json",
-          createAlpacaJSON(transactionID, 0, "", "bool", "true").c_str());
-    } else {
-      server.send(400, "text/plain", "GET only");
-    }
+  if (!req.params->brightnessValid) {
+    // 0x401 is ASCOM InvalidValue
+    sendAlpacaError(400, req.transactionID, 0x401,
+                    "Brightness must be an integer.");
     return;
   }
-  // canhalt
-  if (uri.indexOf("canhalt") != -1) {
-    if (method == "GET") {
-      server.send(
-          200, "application/json",
-          createAlpacaJSON(transactionID, 0, "", "bool", "true").c_str());
-    } else {
-      server.send(400, "text/plain", "GET only");
-    }
+  int brightness = req.params->brightness;
+  int result;
+  if (!runControlCommand(req.deviceNumber, CONTROL_SET_BRIGHTNESS, brightness,
+                         &result)) {
+    sendControlBusy(req);
     return;
   }
-  // covermoving
-  if (uri.indexOf("covermoving") != -1) {
-    if (method == "GET") {
-      String isMoving =
-          (coverState_1 == 3) ? "true" : "false"; // 3 = coverMoving
-      server.send(
-          200, "application/json",
-          createAlpacaJSON(transactionID, 0, "", "bool", isMoving).c_str());
-    } else {
-      server.send(400, "text/plain", "GET only");
-    }
+  // Check Lock: no light while the cap is travelling (control task decides)
+  if (result == BRIGHTNESS_REFUSED) {
+    sendAlpacaError(403, req.transactionID, 0x40B,
+                    "Calibrator is NotReady (Cover is moving).");
     return;
   }
-  // calibratorchanging
-  if (uri.indexOf("calibratorchanging") != -1) {
-    if (method == "GET") {
-      server.send(
-          200, "application/json",
-          createAlpacaJSON(transactionID, 0, "", "bool", "false").c_str());
-    } else {
-      server.send(400, "text/plain", "GET only");
-    }
+  sendAlpacaOK(req.transactionID);
+}
+
+// --- 'calibratoroff' Method (PUT) ---
+static void handleCoverCalibratorCalibratorOff(const AlpacaRequest &req) {
+  if (!req.isPut) {
+    http->send(400, "text/plain", "CalibratorOff must be a PUT request.");
+    return;
+  }
+  if (!runControlCommand(req.deviceNumber, CONTROL_SET_BRIGHTNESS, 0,
+                         nullptr)) {
+    sendControlBusy(req);
     return;
   }
+  sendAlpacaOK(req.transactionID);
+}
 
-  // --- 7. Handle 'CalibratorOn' Method (PUT) ---
-  if (uri.indexOf("calibratoron") != -1) {
-    if (method == "PUT") {
-      if (server.hasArg("Brightness")) {
-        int brightness = server.arg("Brightness").toInt();
-        // Check Lock (logic retained from our previous work)
-        if (calibratorState_1 == calibratorNotReady) {
-          String errorMsg =
-              "Calibrator is NotReady (Cover is closed or moving).";
-          String responseJson =
-              createAlpacaJSON(clientID, 0x401, errorMsg, "", "");
-          server.send(403, "application/json", responseJson.c_str());
-          return;
-        }
-        setDimmerValue(brightness);
-
-        String responseJson = createAlpacaJSON(clientID, 0, "", "", "");
-        server.send(200, "application/json", responseJson.c_str());
-      } else {
-        server.send(400, "text/plain",
-                    "Missing Brightness parameter for CalibratorOn.");
-      }
-    } else {
-      server.send(400, "text/plain", "CalibratorOn must be a PUT request.");
-    }
+// --- 'devicestate' Property (GET only) ---
+static void handleCoverCalibratorDeviceState(const AlpacaRequest &req) {
+  if (req.isPut) {
+    http->send(400, "text/plain",
+                "Error: DeviceState is a GET-only property.");
     return;
   }
+  // One snapshot for all fields, so they always belong together
+  DeviceSnapshot state;
+  readDeviceSnapshot(req.deviceNumber, state);
+  AlpacaResponse response(req.transactionID);
+
+  // "Value" is an array of Name/Value pairs
+  response.beginValueArray();
+
+  // Connection Status (hardcoded true as we are connected to reach this point)
+  response.beginObject();
+  response.member("Name", "Connected");
+  response.member("Value", true);
+  response.endObject();
+
+  // Cover Position Status (1=Closed, 2=Moving, 3=Open, 4=Unknown)
+  response.beginObject();
+  response.member("Name", "CoverState");
+  response.member("Value", state.coverState);
+  response.endObject();
+
+  // Calibrator/Dimmer Status (1=Off, 2=NotReady/ramping, 3=Ready)
+  response.beginObject();
+  response.member("Name", "CalibratorState");
+  response.member("Value", state.calibratorState);
+  response.endObject();
+
+  response.beginObject();
+  response.member("Name", "CalibratorChanging");
+  response.member("Value", state.calibratorChanging);
+  response.endObject();
+
+  response.beginObject();
+  response.member("Name", "CoverMoving");
+  response.member("Value", state.coverState == coverMoving);
+  response.endObject();
+
+  // Current Dimmer Brightness (0 to MaxBrightness)
+  response.beginObject();
+  response.member("Name", "Brightness");
+  response.member("Value", state.brightness);
+  response.endObject();
+
+  // On-device flat sequence progress (Action "StartSequence")
+  response.beginObject();
+  response.member("Name", "SequenceState");
+  response.member("Value", sequenceStateName(state.sequenceState));
+  response.endObject();
+
+  response.beginObject();
+  response.member("Name", "SequenceStep");
+  response.member("Value", state.sequenceStep);
+  response.endObject();
+
+  // Acknowledgement of the last group command
+  response.beginObject();
+  response.member("Name", "GroupCounter");
+  response.member("Value", (long)state.groupCounter);
+  response.endObject();
+
+  response.beginObject();
+  response.member("Name", "GroupStatus");
+  response.member("Value", groupStatusName(state.groupStatus));
+  response.endObject();
+
+  response.endArray();
+
+  http->sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
+  response.send();
+}
 
-  // --- 8. Handle 'CalibratorOff' Method (PUT) ---
-  if (uri.indexOf("calibratoroff") != -1) {
-    if (method == "PUT") {
-      analogWrite(elPin_1, 0);
-      currentDimmerValue_1 = 0;
-      isDimmerActive = false;
+// --- 'driverinfo' Property (GET only) ---
+static void handleCoverCalibratorDriverInfo(const AlpacaRequest &req) {
+  if (req.isPut) {
+    sendAlpacaError(400, req.transactionID, 0x403,
+                    "DriverInfo is a GET-only property.");
+    return;
+  }
+  sendCachedAlpacaResponse(ALPACA_CACHED_DRIVER_INFO, req.transactionID);
+}
 
-      String responseJson = createAlpacaJSON(clientID, 0, "", "", "");
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      server.send(400, "text/plain", "CalibratorOff must be a PUT request.");
-    }
+// --- 'driverversion' Property (GET only) ---
+static void handleCoverCalibratorDriverVersion(const AlpacaRequest &req) {
+  if (req.isPut) {
+    sendAlpacaError(400, req.transactionID, 0x403,
+                    "DriverVersion is a GET-only property.");
     return;
   }
-  // --- 9. Handle 'devicestate' Method (PUT) ---
-  if (uri.indexOf("devicestate") != -1) {
-    if (method == "GET") {
-      // --- 1. Allocate JSON Document ---
-      // Allocate a size large enough for the response array (512 is usually
-      // safe)
-      StaticJsonDocument<512> doc;
-
-      // --- 2. Build the Mandatory ASCOM Header ---
-      doc["ClientTransactionID"] = transactionID;
-      doc["ServerTransactionID"] = serverTransactionID++;
-      doc["ErrorNumber"] = 0;
-      doc["ErrorMessage"] = "";
-
-      // --- 3. Create the JSON Array for "Value" ---
-      JsonArray valueArray = doc.createNestedArray("Value");
-
-      // --- 4. Populate the Array with Name/Value Pairs ---
-      // Item 1: Connection Status
-      JsonObject item1 = valueArray.createNestedObject();
-      item1["Name"] = "Connected";
-      item1["Value"] =
-          true; // Hardcoded true as we are connected to reach this point
-
-      // Item 2: Cover Position Status (0=Ready, 1=Open, 2=Closed, 3=Moving)
-      JsonObject item2 = valueArray.createNestedObject();
-      item2["Name"] = "CoverState";
-      item2["Value"] = coverState_1; // Global variable updated by sensor logic
-
-      // Item 3: Calibrator/Dimmer Status (0=Ready/ON/OFF, 1=NotReady)
-      JsonObject item3 = valueArray.createNestedObject();
-      item3["Name"] = "CalibratorState";
-      item3["Value"] =
-          calibratorState_1; // Global variable updated by dimmer lock logic
-
-      // Item 4: Current Dimmer Brightness (0 to MaxBrightness)
-      JsonObject item4 = valueArray.createNestedObject();
-      item4["Name"] = "Brightness";
-      item4["Value"] = currentDimmerValue_1;
-
-      // --- 5. Serialize and Send Response ---
-      String responseJson;
-      serializeJson(doc, responseJson);
-
-      server.sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      // PUT requests are not supported for DeviceState
-      server.send(400, "text/plain",
-                  "Error: DeviceState is a GET-only property.");
-    }
+  sendCachedAlpacaResponse(ALPACA_CACHED_DRIVER_VERSION, req.transactionID);
+}
+
+// Shared by opencover/closecover: starts the move and answers at once.
+// Completion is tracked by the motion engine in the control task.
+static void requestCoverMove(const AlpacaRequest &req, bool open) {
+  int result;
+  if (!runControlCommand(req.deviceNumber,
+                         open ? CONTROL_OPEN_COVER : CONTROL_CLOSE_COVER, 0,
+                         &result)) {
+    sendControlBusy(req);
     return;
   }
-  // --- 10. Handle 'DriverInfo' Method (PUT) ---
-  if (uri.indexOf("driverinfo") != -1) {
-    if (method == "GET") {
-      // Build the informational string
-      String info = "FlatCat CoverCalibrator V2.0 |";
-      info += "ASCOM Alpaca Driver by Orangemaze |";
-      info += "Compiled: " __DATE__ " " __TIME__
-              " |"; // Use compiler macros for date/time
-      info += "Hardware: Flat Panel/Lens Cap";
-
-      // Return the string value
-      String responseJson =
-          createAlpacaJSON(transactionID, 0, "", "string", info);
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      // FIX: Reject PUT requests with the correct 400 Bad Request status.
-      String errorMsg = "DriverInfo is a GET-only property.";
-      String responseJson =
-          createAlpacaJSON(transactionID, 0x403, errorMsg, "",
-                           ""); // 0x403 InvalidOperationException
-      server.send(400, "application/json", responseJson.c_str());
-    }
+  switch (result) {
+  case COVER_MOVE_BLOCKED:
+    // 0x401 is ASCOM InvalidOperationException
+    sendAlpacaError(403, req.transactionID, 0x401,
+                    open ? "Cannot open cover: Calibrator is currently ON."
+                         : "Cannot close cover: Calibrator is currently ON.");
+    break;
+  case COVER_MOVE_ALREADY_THERE:
+    sendAlpacaError(200, req.transactionID, 0,
+                    open ? "Cover is already in the Open position."
+                         : "Cover is already in the Closed position.");
+    break;
+  case COVER_MOVE_STARTED:
+    sendAlpacaOK(req.transactionID); // CoverState now reports Moving
+    break;
+  }
+}
+
+// --- 'opencover' Method (PUT) ---
+static void handleCoverCalibratorOpenCover(const AlpacaRequest &req) {
+  if (!req.isPut) {
+    sendAlpacaError(400, req.transactionID, 0x403,
+                    "OpenCover must be a PUT request.");
     return;
   }
-  if (uri.indexOf("driverversion") != -1) {
-    if (method == "GET") {
-      // Return the version string for the driver.
-      String value = "2.0.0"; // Use your current driver version string
-      String responseJson =
-          createAlpacaJSON(transactionID, 0, "", "string", value);
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      // DriverVersion is GET-only
-      String errorMsg = "DriverVersion is a GET-only property.";
-      String responseJson =
-          createAlpacaJSON(transactionID, 0x403, errorMsg, "", "");
-      server.send(400, "application/json", responseJson.c_str());
-    }
+  requestCoverMove(req, true);
+}
+
+// --- 'closecover' Method (PUT) ---
+static void handleCoverCalibratorCloseCover(const AlpacaRequest &req) {
+  if (!req.isPut) {
+    sendAlpacaError(400, req.transactionID, 0x403,
+                    "CloseCover must be a PUT request.");
     return;
   }
-  if (uri.indexOf("opencover") != -1) {
-    if (method == "PUT") {
-      // Error Check 1: Prevent operation if dimmer is ON
-      if (isDimmerActive) {
-        String errorMsg = "Cannot open cover: Calibrator is currently ON.";
-        // 0x401 is ASCOM InvalidOperationException
-        String responseJson =
-            createAlpacaJSON(transactionID, 0x401, errorMsg, "", "");
-        server.send(403, "application/json", responseJson.c_str());
-        return;
-      }
-
-      // Error Check 2: Check if already open (using the sensor flag)
-      if (isOpenStopActive_1) {
-        String errorMsg = "Cover is already in the Open position.";
-        String responseJson =
-            createAlpacaJSON(transactionID, 0, errorMsg, "", "");
-        server.send(200, "application/json", responseJson.c_str());
-        return;
-      }
-
-      // --- Execute Device Operation ---
-      // These actions initiate the movement: attach servo, set flags, and
-      // command the angle.
-      myServo_1.attach(servoPin_1);
-      isMovingToClose_1 = false;
-      isMovingToOpen_1 = true;
-      coverState_1 = coverMoving;
-      myServo_1.write(openAngle);
-
-      // FIX: Force blocking wait to ensure signal generates (Same as Web UI
-      // fix)
-      delay(1000);
-
-      // SENSOR MODE RESTORED: State updates via updateCoverStatus() in loop()
-
-      currentServoAngle_1 = openAngle;
-
-      // ASCOM Success Response (200 OK)
-      String responseJson = createAlpacaJSON(transactionID, 0, "", "", "");
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      // Reject GET method
-      String errorMsg = "OpenCover must be a PUT request.";
-      String responseJson =
-          createAlpacaJSON(transactionID, 0x403, errorMsg, "", "");
-      server.send(400, "application/json", responseJson.c_str());
-    }
+  requestCoverMove(req, false);
+}
+
+// --- 'haltcover' Method (PUT) ---
+static void handleCoverCalibratorHaltCover(const AlpacaRequest &req) {
+  if (!req.isPut) {
+    sendAlpacaError(400, req.transactionID, 0x403,
+                    "HaltCover must be a PUT request.");
     return;
   }
-  if (uri.indexOf("closecover") != -1) {
-    if (method == "PUT") {
-      // Error Check 1: Prevent operation if dimmer is ON
-      if (isDimmerActive) {
-        String errorMsg = "Cannot close cover: Calibrator is currently ON.";
-        // 0x401 is ASCOM InvalidOperationException
-        String responseJson =
-            createAlpacaJSON(transactionID, 0x401, errorMsg, "", "");
-        server.send(403, "application/json", responseJson.c_str());
-        return;
-      }
-
-      // Error Check 2: Check if already closed (using the sensor flag)
-      if (isClosedStopActive_1) {
-        String errorMsg = "Cover is already in the Closed position.";
-        String responseJson =
-            createAlpacaJSON(transactionID, 0, errorMsg, "", "");
-        server.send(200, "application/json", responseJson.c_str());
-        return;
-      }
-
-      // --- Execute Device Operation ---
-      // These actions initiate the movement: attach servo, set flags, and
-      // command the angle.
-      myServo_1.attach(servoPin_1);
-      isMovingToOpen_1 = false;
-      isMovingToClose_1 = true;
-      coverState_1 = coverMoving;
-      myServo_1.write(closeAngle);
-
-      // FIX: Force blocking wait to ensure signal generates (Same as Web UI
-      // fix)
-      delay(1000);
-
-      // SENSOR MODE RESTORED: State updates via updateCoverStatus() in loop()
-
-      currentServoAngle_1 = closeAngle;
-
-      // ASCOM Success Response (200 OK)
-      String responseJson = createAlpacaJSON(transactionID, 0, "", "", "");
-      server.send(200, "application/json", responseJson.c_str());
-    } else {
-      // Reject GET method
-      String errorMsg = "CloseCover must be a PUT request.";
-      String responseJson =
-          createAlpacaJSON(transactionID, 0x403, errorMsg, "", "");
-      server.send(400, "application/json", responseJson.c_str());
+  if (!runControlCommand(req.deviceNumber, CONTROL_HALT_COVER, 0, nullptr)) {
+    sendControlBusy(req);
+    return;
+  }
+  sendAlpacaOK(req.transactionID);
+}
+
+// --- 'action' Method (PUT) ---
+// Preset actions. The preset table is owned by this (the network) task.
+static void recallPresetAction(const AlpacaRequest &req, const char *name) {
+  int index = findBrightnessPreset(name);
+  if (index < 0) {
+    sendAlpacaError(400, req.transactionID, 0x401, "No preset of that name.");
+    return;
+  }
+  int result;
+  if (!recallBrightnessPreset(req.deviceNumber, index, &result)) {
+    sendControlBusy(req);
+    return;
+  }
+  if (result == BRIGHTNESS_REFUSED) {
+    sendAlpacaError(403, req.transactionID, 0x40B,
+                    "Calibrator is NotReady (Cover is moving).");
+    return;
+  }
+  sendAlpacaValue(req.transactionID, brightnessPresets[index].name);
+}
+
+static void listPresetsAction(const AlpacaRequest &req) {
+  // Names are restricted to plain characters, so no escaping is needed
+  char list[MAX_BRIGHTNESS_PRESETS * 80 + 3];
+  size_t n = 0;
+  list[n++] = '[';
+  for (const BrightnessPreset &preset : brightnessPresets) {
+    if (preset.name[0] == '\0') {
+      continue;
     }
+    n += snprintf(list + n, sizeof(list) - n,
+                  "%s{\"Name\":\"%s\",\"Brightness\":%ld,"
+                  "\"RampMs\":%ld,\"DwellMs\":%ld}",
+                  n > 1 ? "," : "", preset.name, (long)preset.brightness,
+                  (long)preset.rampMs, (long)preset.dwellMs);
+  }
+  snprintf(list + n, sizeof(list) - n, "]");
+  sendAlpacaValue(req.transactionID, list);
+}
+
+static void savePresetAction(const AlpacaRequest &req, char *parameters) {
+  // "name,brightness[,rampMs[,dwellMs]]"
+  char *fields[4] = {};
+  int count = 0;
+  for (char *field = strtok(parameters, ","); field && count < 4;
+       field = strtok(nullptr, ",")) {
+    fields[count++] = field;
+  }
+  if (count < 2 || !isNumeric(fields[1]) ||
+      (count > 2 && !isNumeric(fields[2]) && strcmp(fields[2], "-1") != 0) ||
+      (count > 3 && !isNumeric(fields[3]))) {
+    sendAlpacaError(400, req.transactionID, 0x401,
+                    "Parameters must be name,brightness[,rampMs[,dwellMs]].");
+    return;
+  }
+  int rampMs = (count > 2) ? atoi(fields[2]) : -1;
+  int dwellMs = (count > 3) ? atoi(fields[3]) : 0;
+  if (!setBrightnessPreset(fields[0], atoi(fields[1]), rampMs, dwellMs)) {
+    sendAlpacaError(400, req.transactionID, 0x401,
+                    "Invalid preset name, or the preset table is full.");
     return;
   }
-  // --- Fall-through for unimplemented methods/properties (FIX for 501/descrip)
-  // --- If the request reached this point, the member name was invalid (like
-  // 'descrip') or a valid member was requested with an unsupported method
-  // (e.g., PUT on a GET-only property).
-  String errorMsg = "Unknown member or unsupported action: " + uri;
+  saveBrightnessPresets();
+  sendAlpacaValue(req.transactionID, fields[0]);
+}
 
-  // 0x403 is ASCOM InvalidOperationException
-  String responseJson =
-      createAlpacaJSON(transactionID, 0x403, errorMsg, "", "");
+static void startSequenceAction(const AlpacaRequest &req,
+                                const char *parameters) {
+  switch (uploadSequence(req.deviceNumber, parameters)) {
+  case SEQUENCE_UPLOAD_STARTED:
+    sendAlpacaValue(req.transactionID, "");
+    break;
+  case SEQUENCE_UPLOAD_PENDING:
+    sendAlpacaValue(req.transactionID, "pending"); // Queued, starts shortly
+    break;
+  case SEQUENCE_UPLOAD_INVALID:
+    sendAlpacaError(400, req.transactionID, 0x401,
+                    "Steps must be brightness,rampMs,holdMs[,open|close] "
+                    "separated by ';'.");
+    break;
+  case SEQUENCE_UPLOAD_BUSY:
+    sendControlBusy(req);
+    break;
+  }
+}
 
-  // Use 400 Bad Request status code
-  server.send(400, "application/json", responseJson.c_str());
+static void sequenceStatusAction(const AlpacaRequest &req) {
+  char status[128];
+  formatSequenceStatus(req.deviceNumber, status, sizeof(status));
+  sendAlpacaValue(req.transactionID, status);
 }
 
-// Main Alpaca API Router
-void handleAlpacaAPI() {
-  String uri = server.uri();
+// Stores the photodiode reading of the lit panel as its reference, which
+// turns on closed-loop regulation for the device
+static void captureLightAction(const AlpacaRequest &req) {
+  int fullScaleMv;
+  if (!runControlCommand(req.deviceNumber, CONTROL_CAPTURE_LIGHT, 0,
+                         &fullScaleMv)) {
+    sendControlBusy(req);
+    return;
+  }
+  if (fullScaleMv < 0) {
+    sendAlpacaError(400, req.transactionID, 0x40B,
+                    "Needs a photodiode and a lit, steady panel.");
+    return;
+  }
+  // Already stored by the control task (see captureLightReference())
+  currentSettings.photoFullScaleMv[req.deviceNumber] = fullScaleMv;
 
-  // Logic for ClientID and ClientTransactionID retrieval (Focus on correct
-  // casing)
-  long clientTransactionID = 0;
-  long clientID = 0;
+  char value[16];
+  snprintf(value, sizeof(value), "%d", fullScaleMv);
+  sendAlpacaValue(req.transactionID, value);
+}
 
-  // 1. Get the ClientTransactionID (Case Sensitive - this is the one we care
-  // about)
-  // 1. Get the ClientTransactionID
-  if (server.hasArg("ClientTransactionID")) {
-    String ctidStr = server.arg("ClientTransactionID");
-    // Use strtol() for universal compiler compatibility
-    long tempID = strtol(ctidStr.c_str(), NULL, 10);
-    clientTransactionID = strtol(ctidStr.c_str(), NULL, 10);
-    if (tempID > 0) {
-      clientTransactionID = tempID;
+static void handleCoverCalibratorAction(const AlpacaRequest &req) {
+  if (!req.isPut) {
+    sendAlpacaError(400, req.transactionID, 0x403,
+                    "Action must be a PUT request.");
+    return;
+  }
+  char action[32];
+  char parameters[ALPACA_ACTION_PARAMETERS_SIZE];
+  bool truncated;
+  copyAlpacaParam(req.params->action, action, sizeof(action));
+  copyAlpacaParam(req.params->parameters, parameters, sizeof(parameters),
+                  &truncated);
+  if (truncated) {
+    // A cut step list could still parse as a different program
+    sendAlpacaError(400, req.transactionID, 0x401, "Parameters too long.");
+    return;
+  }
+
+  if (strcasecmp(action, "RecallPreset") == 0) {
+    recallPresetAction(req, parameters);
+  } else if (strcasecmp(action, "ListPresets") == 0) {
+    listPresetsAction(req);
+  } else if (strcasecmp(action, "SavePreset") == 0) {
+    savePresetAction(req, parameters);
+  } else if (strcasecmp(action, "DeletePreset") == 0) {
+    if (!deleteBrightnessPreset(parameters)) {
+      sendAlpacaError(400, req.transactionID, 0x401,
+                      "No preset of that name.");
+      return;
+    }
+    saveBrightnessPresets();
+    sendAlpacaValue(req.transactionID, parameters);
+  } else if (strcasecmp(action, "StartSequence") == 0) {
+    startSequenceAction(req, parameters);
+  } else if (strcasecmp(action, "AbortSequence") == 0) {
+    if (!runControlCommand(req.deviceNumber, CONTROL_ABORT_SEQUENCE, 0,
+                           nullptr)) {
+      sendControlBusy(req);
+      return;
     }
+    sendAlpacaValue(req.transactionID, "");
+  } else if (strcasecmp(action, "SequenceStatus") == 0) {
+    sequenceStatusAction(req);
+  } else if (strcasecmp(action, "CaptureLightReference") == 0) {
+    captureLightAction(req);
+  } else {
+    // 0x40C is ASCOM ActionNotImplementedException
+    sendAlpacaError(400, req.transactionID, 0x40C,
+                    "Action is not implemented; see SupportedActions.");
   }
+}
 
-  // 2. Get the ClientID
-  if (server.hasArg("ClientID")) {
-    String cidStr = server.arg("ClientID");
-    // Use strtol() for universal compiler compatibility
-    clientID = strtol(cidStr.c_str(), NULL, 10);
+// ----------------------------------------------------------------
+// Member table. Lookup is a compile-time perfect hash over the member names
+// followed by one exact string compare, so "brightness" can no longer shadow
+// "maxbrightness" and dispatch cost does not grow with the member count.
+// ----------------------------------------------------------------
+static constexpr std::array<AlpacaMemberEntry, 22> coverCalibratorMembers = {{
+    {"action", handleCoverCalibratorAction},
+    {"brightness", handleCoverCalibratorBrightness},
+    {"calibratorchanging", handleCoverCalibratorCalibratorChanging},
+    {"calibratoroff", handleCoverCalibratorCalibratorOff},
+    {"calibratoron", handleCoverCalibratorCalibratorOn},
+    {"calibratorstate", handleCoverCalibratorCalibratorState},
+    {"canclose", handleCoverCalibratorCapability},
+    {"canhalt", handleCoverCalibratorCapability},
+    {"canopen", handleCoverCalibratorCapability},
+    {"closecover", handleCoverCalibratorCloseCover},
+    {"connected", handleCoverCalibratorConnected},
+    {"covermoving", handleCoverCalibratorCoverMoving},
+    {"coverstate", handleCoverCalibratorCoverState},
+    {"description", handleCoverCalibratorDescription},
+    {"devicestate", handleCoverCalibratorDeviceState},
+    {"driverinfo", handleCoverCalibratorDriverInfo},
+    {"driverversion", handleCoverCalibratorDriverVersion},
+    {"haltcover", handleCoverCalibratorHaltCover},
+    {"interfaceversion", handleCoverCalibratorInterfaceVersion},
+    {"maxbrightness", handleCoverCalibratorMaxBrightness},
+    {"opencover", handleCoverCalibratorOpenCover},
+    {"supportedactions", handleCoverCalibratorSupportedActions},
+}};
+
+static constexpr size_t ALPACA_MEMBER_SLOTS = 64; // Power of two >= 3x members
+
+// FNV-1a, seeded so we can search for a collision-free seed at compile time
+static constexpr uint32_t alpacaMemberHash(const char *name, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  while (*name) {
+    h ^= (uint8_t)*name++;
+    h *= 16777619u;
   }
-  bool ctidValid = false;
-  String ctidStr;
+  // The low bits of an FNV product only see the low bits of the input, so
+  // fold the high half in before the slot is taken modulo a power of two
+  return h ^ (h >> 16);
+}
 
-  if (server.hasArg("ClientTransactionID")) {
-    ctidStr = server.arg("ClientTransactionID");
+template <size_t N>
+static constexpr uint32_t
+findPerfectMemberSeed(const std::array<AlpacaMemberEntry, N> &members) {
+  for (uint32_t seed = 0; seed < 100000; seed++) {
+    bool used[ALPACA_MEMBER_SLOTS] = {};
+    bool collision = false;
+    for (size_t i = 0; i < N && !collision; i++) {
+      uint32_t slot =
+          alpacaMemberHash(members[i].name, seed) % ALPACA_MEMBER_SLOTS;
+      collision = used[slot];
+      used[slot] = true;
+    }
+    if (!collision)
+      return seed;
+  }
+  return UINT32_MAX;
+}
 
-    // Check 1: Check for valid content (non-empty, non-zero number)
-    if (ctidStr.length() > 0 && ctidStr.toInt() != 0) {
-      clientTransactionID = ctidStr.toInt();
-      ctidValid = true;
+static constexpr uint32_t coverCalibratorSeed =
+    findPerfectMemberSeed(coverCalibratorMembers);
+static_assert(coverCalibratorSeed != UINT32_MAX,
+              "No perfect hash seed for the CoverCalibrator member table");
+
+template <size_t N>
+static constexpr std::array<int8_t, ALPACA_MEMBER_SLOTS>
+buildMemberSlots(const std::array<AlpacaMemberEntry, N> &members,
+                 uint32_t seed) {
+  std::array<int8_t, ALPACA_MEMBER_SLOTS> slots{};
+  for (size_t i = 0; i < ALPACA_MEMBER_SLOTS; i++)
+    slots[i] = -1;
+  for (size_t i = 0; i < N; i++)
+    slots[alpacaMemberHash(members[i].name, seed) % ALPACA_MEMBER_SLOTS] =
+        (int8_t)i;
+  return slots;
+}
+
+static constexpr std::array<int8_t, ALPACA_MEMBER_SLOTS> coverCalibratorSlots =
+    buildMemberSlots(coverCalibratorMembers, coverCalibratorSeed);
+
+// Returns the handler for an already-lowercased member name, or nullptr
+static AlpacaMemberHandler findCoverCalibratorMember(const char *member) {
+  uint32_t slot =
+      alpacaMemberHash(member, coverCalibratorSeed) % ALPACA_MEMBER_SLOTS;
+  int8_t index = coverCalibratorSlots[slot];
+  if (index < 0 || strcmp(coverCalibratorMembers[index].name, member) != 0)
+    return nullptr;
+  return coverCalibratorMembers[index].handler;
+}
+
+// Implements /api/v1/covercalibrator/{devicenumber}/{member}
+static void handleAlpacaCoverCalibrator(const AlpacaPath &path,
+                                        HTTPMethod method,
+                                        const AlpacaParams &params) {
+  const char *devNumStr = path.segment[3];
+  const char *member = path.segment[4];
+  long transactionID = params.clientTransactionID;
+
+  // 1. Check if the string contains non-numeric characters (like 'A')
+  if (devNumStr[0] == '\0' || !isNumeric(devNumStr)) {
+    sendAlpacaError(400, transactionID, 0x100,
+                    "Invalid device number format. Must be numeric.");
+    return;
+  }
+
+  // 2. Check that the number is one of the configured devices
+  int requestedDevNum = atoi(devNumStr);
+  if (strlen(devNumStr) > 3 || requestedDevNum >= coverCalibratorCount) {
+    char errorMsg[96];
+    snprintf(errorMsg, sizeof(errorMsg),
+             "Invalid device number: %s. Devices 0 to %d are configured.",
+             devNumStr, coverCalibratorCount - 1);
+    sendAlpacaError(400, transactionID, 0x100, errorMsg);
+    return;
+  }
+
+  AlpacaMemberHandler handler =
+      (path.count == 5) ? findCoverCalibratorMember(member) : nullptr;
+  if (handler == nullptr) {
+    // The member name was invalid (like 'descrip') or missing.
+    // 0x403 is ASCOM InvalidOperationException, sent as 400 Bad Request
+    char errorMsg[80];
+    snprintf(errorMsg, sizeof(errorMsg),
+             "Unknown member or unsupported action: %s", member);
+    sendAlpacaError(400, transactionID, 0x403, errorMsg);
+    return;
+  }
+
+  AlpacaRequest req;
+  req.clientID = params.clientID;
+  req.transactionID = transactionID;
+  req.deviceNumber = requestedDevNum;
+  req.isPut = (method == HTTP_PUT);
+  req.params = &params;
+  handler(req);
+}
+
+// Splits a request path into lowercased segments. Returns false if it has
+// more, or longer, segments than any Alpaca endpoint.
+bool splitAlpacaPath(const char *uri, AlpacaPath &path) {
+  path.count = 0;
+  for (int i = 0; i < ALPACA_MAX_PATH_SEGMENTS; i++)
+    path.segment[i][0] = '\0';
+
+  const char *p = uri;
+  while (*p) {
+    while (*p == '/')
+      p++;
+    if (!*p)
+      break;
+    if (path.count == ALPACA_MAX_PATH_SEGMENTS)
+      return false;
+    char *out = path.segment[path.count++];
+    size_t n = 0;
+    while (*p && *p != '/') {
+      if (n + 1 >= ALPACA_SEGMENT_SIZE)
+        return false;
+      out[n++] = (char)tolower((unsigned char)*p++);
     }
+    out[n] = '\0';
   }
+  return true;
+}
+
+static bool segmentIs(const AlpacaPath &path, int i, const char *expected) {
+  return i < path.count && strcmp(path.segment[i], expected) == 0;
+}
+
+// Main Alpaca API Router. 'path' has already been split by the HTTP back
+// end; the request arguments are scanned once here.
+void handleAlpacaAPI(const AlpacaPath &path, HTTPMethod method) {
+  // One pass over the arguments; names are case-insensitive per the spec
+  AlpacaParams params;
+  http->collectAlpacaParams(params);
+  long clientTransactionID = params.clientTransactionID;
+  bool isDeviceAPI = segmentIs(path, 0, "api");
 
   // --- CRITICAL ERROR CHECK ---
   // The CTID is mandatory for all device calls. If it's not valid, return 400.
-
-  // NOTE: We only require the CTID for Device API calls (CoverCalibrator),
-  // but often fail if it's invalid anywhere it's provided.
-  if (server.uri().indexOf("/api/v1/") != -1 && !ctidValid) {
-    String errorMsg = "Invalid or missing ClientTransactionID.";
+  if (isDeviceAPI && !params.clientTransactionIDValid) {
     // Pass 0 as the ID since the sent ID is invalid
-    String responseJson = createAlpacaJSON(0, 0x100, errorMsg, "", "");
-    server.send(400, "application/json", responseJson.c_str());
+    sendAlpacaError(400, 0, 0x100, "Invalid or missing ClientTransactionID.");
     return;
   }
-  String method = server.method() == HTTP_GET || server.method() == HTTP_HEAD
-                      ? "GET"
-                      : (server.method() == HTTP_PUT ? "PUT" : "UNSUPPORTED");
 
-  if (method == "UNSUPPORTED") {
-    server.send(405, "text/plain",
+  if (method != HTTP_GET && method != HTTP_HEAD && method != HTTP_PUT) {
+    http->send(405, "text/plain",
                 "Method not supported. Only GET, HEAD, and PUT are valid.");
     return;
   }
 
   // --- Alpaca Routing Logic ---
-  // Management calls should use the CTID as the clientID
-  if (uri.indexOf("/management/v1/apiversions") != -1 ||
-      uri.indexOf("/management/apiversions") != -1) {
+  if (isDeviceAPI) {
+    if (segmentIs(path, 1, "v1") &&
+        segmentIs(path, 2, "covercalibrator")) {
+      handleAlpacaCoverCalibrator(path, method, params);
+      return;
+    }
+  } else if (path.count == 2 && segmentIs(path, 1, "apiversions")) {
+    // Management calls use the CTID as the clientID
     handleAlpacaAPIVersions(clientTransactionID);
-  } else if (uri.indexOf("/management/v1/description") != -1) {
-    handleAlpacaDescription(clientTransactionID);
-  } else if (uri.indexOf("/management/v1/configureddevices") != -1) {
-    handleAlpacaConfiguredDevices(clientTransactionID);
-  } else if (uri.indexOf("/management/v1/supporteddevices") != -1) {
-    handleAlpacaSupportedDevices();
-  }
-  // Device API call
-  else if (uri.indexOf("/api/v1/covercalibrator") != -1) {
-    // Pass clientID and clientTransactionID correctly
-    handleAlpacaCoverCalibrator(clientID, clientTransactionID, 0);
-  } else {
-    server.send(404, "text/plain", "Invalid ASCOM API endpoint.");
+    return;
+  } else if (path.count == 3 && segmentIs(path, 1, "v1")) {
+    const char *endpoint = path.segment[2];
+    if (strcmp(endpoint, "apiversions") == 0) {
+      handleAlpacaAPIVersions(clientTransactionID);
+      return;
+    } else if (strcmp(endpoint, "description") == 0) {
+      handleAlpacaDescription(clientTransactionID);
+      return;
+    } else if (strcmp(endpoint, "configureddevices") == 0) {
+      handleAlpacaConfiguredDevices(clientTransactionID);
+      return;
+    } else if (strcmp(endpoint, "supporteddevices") == 0) {
+      handleAlpacaSupportedDevices();
+      return;
+    }
+  }
+  http->send(404, "text/plain", "Invalid ASCOM API endpoint.");
+}
+
+// ================================================================
+// --- ALPACA REQUEST HANDLER ---
+// ================================================================
+
+// Claims /api/v1/... and /management/... before WebServer falls back to
+// onNotFound, so Alpaca traffic never takes the 404 path.
+bool AlpacaRequestHandler::canHandle(HTTPMethod method, const String &uri) {
+  return isAlpacaPath(uri.c_str());
+}
+
+bool AlpacaRequestHandler::handle(WebServer &server, HTTPMethod requestMethod,
+                                  const String &requestUri) {
+  WebServerContext context;
+  http = &context;
+  dispatchAlpacaRequest(requestUri.c_str(), requestMethod);
+  http = nullptr;
+  return true;
+}
+
+// Entry point for both HTTP back ends once 'http' is set up
+void dispatchAlpacaRequest(const char *uri, HTTPMethod method) {
+  AlpacaPath path;
+  if (!splitAlpacaPath(uri, path)) {
+    http->send(404, "text/plain", "Invalid ASCOM API endpoint.");
+    return;
   }
+  handleAlpacaAPI(path, method);
+}
+
+bool isAlpacaPath(const char *uri) {
+  return strncasecmp(uri, "/api/v1/", 8) == 0 ||
+         strncasecmp(uri, "/management/", 12) == 0;
 }
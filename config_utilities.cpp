@@ -5,117 +5,18 @@
 // ================================================================
 // --- UTILITY FUNCTIONS ---
 // ================================================================
-/**
- * @brief Checks the Hall sensors to determine the cover's absolute state.
- * * Updates the global coverState_1 based on digital sensor readings.
- * Uses the INPUT_PULLUP setup, meaning the sensor reads LOW when the magnet is
- * present.
- */
 /**
  * @brief Checks if a string contains only digits.
  */
-bool isNumeric(String str) {
-  for (int i = 0; i < str.length(); i++) {
-    if (!isDigit(str.charAt(i))) {
+bool isNumeric(const char *str) {
+  for (; *str; str++) {
+    if (!isDigit(*str)) {
       return false;
     }
   }
   return true;
 }
 
-void setDimmerValue(int brightness) {
-  // 1. Clamp the brightness value to the valid range (1 to MaxBrightness).
-  brightness = constrain(brightness, 0, maxBrightness);
-
-  // 2. Update the global state variable
-  currentDimmerValue_1 = brightness;
-  Serial.println(currentDimmerValue_1);
-  // 3. Map the Alpaca brightness (0-64) to the hardware PWM duty cycle (0-255).
-  int newPwmValue = map(currentDimmerValue_1, 0, maxBrightness, 0, 255);
-  Serial.println(newPwmValue);
-  analogWrite(elPin_1, newPwmValue);
-
-  // 4. Update the dimmer active flag
-  isDimmerActive = (brightness > 0);
-}
-
-int validateDeviceNumber(String uri) {
-  // Find the position of the device number (which is always after the interface
-  // name)
-  int start = uri.indexOf("covercalibrator/");
-  if (start == -1)
-    return -1; // Should not happen if routed correctly
-
-  start += strlen("covercalibrator/");
-
-  int end = uri.indexOf('/', start);
-  if (end == -1)
-    end =
-        uri.length(); // Handle cases where device number is the end of the URI
-
-  String devNumStr = uri.substring(start, end);
-
-  // Check if the number is valid (e.g., "0")
-  if (devNumStr.equals("0")) {
-    return 0; // Device 0 is valid (CoverCalibrator 1)
-  }
-
-  // Reject non-numeric or out-of-range device numbers
-  if (!devNumStr.toInt())
-    return -1; // Catches "A" and other garbage
-  if (devNumStr.toInt() != 0)
-    return -1; // Catches -1, 99999, etc.
-
-  return -1; // Invalid device number
-}
-
-void updateCoverStatus() {
-  // SENSOR MODE ACTIVE:
-  // Reads physical pins D1/D2 to determine state.
-  isClosedStopActive_1 = (digitalRead(closedStopPin_1) == LOW);
-  isOpenStopActive_1 = (digitalRead(openStopPin_1) == LOW);
-
-  if (isClosedStopActive_1 && !isOpenStopActive_1) {
-    coverState_1 = coverClosed;
-  } else if (isOpenStopActive_1 && !isClosedStopActive_1) {
-    coverState_1 = coverOpen;
-  } else if (!isClosedStopActive_1 && !isOpenStopActive_1) {
-    if (coverState_1 != coverMoving) {
-      coverState_1 = coverReady;
-    }
-  } else {
-    coverState_1 = coverReady;
-  }
-}
-
-void checkAndStopServo() {
-  // --- Stop Logic for Cover 1 ---
-  // FIX: Bypassed sensor stop logic until sensors are attached
-
-  // A. Check if the cover was commanded to CLOSE
-  if (isMovingToClose_1) {
-    /*
-    if (isClosedStopActive_1) {
-      myServo_1.detach(); // Power off the servo immediately to stop movement
-      coverState_1 = coverClosed; // Confirm final state
-      isMovingToClose_1 = false;  // Clear the command flag
-      // Serial.println("Cover 1: CLOSED stop sensor hit. Servo detached.");
-    }
-    */
-  }
-  // B. Check if the cover was commanded to OPEN
-  else if (isMovingToOpen_1) {
-    /*
-    if (isOpenStopActive_1) {
-      myServo_1.detach(); // Power off the servo immediately to stop movement
-      coverState_1 = coverOpen;   // Confirm final state
-      isMovingToOpen_1 = false;   // Clear the command flag
-      // Serial.println("Cover 1: OPEN stop sensor hit. Servo detached.");
-    }
-    */
-  }
-}
-
 void initializeUniqueID() {
   preferences.begin("flatcat", true); // Read-only access initially
 
@@ -150,32 +51,20 @@ void initializeUniqueID() {
     // Serial.printf("Generated and Saved Unique ID: %s\n",
     // deviceUniqueID.c_str());
   }
+  invalidateAlpacaResponseCache(); // configureddevices carries the UniqueID
 }
-void updateDimmerLock() {
-
-  if (coverState_1 == coverClosed || coverState_1 == coverMoving) {
-    // If the cover is closed or moving, the dimmer MUST be off.
-    isDimmerActive = false;
-    analogWrite(elPin_1, 0);
-    // analogWrite(elPin_2, 0);
 
-    // Set the Alpaca Calibrator State
-    calibratorState_1 = calibratorNotReady; // Cannot be used right now
+/**
+ * @brief Writes the Alpaca UniqueID of a device. Device 0 keeps the plain
+ * stored ID (so existing client profiles stay valid); device N gets "-N".
+ */
+void formatDeviceUniqueID(int device, char *out, size_t size) {
+  if (device == 0) {
+    snprintf(out, size, "%s", deviceUniqueID.c_str());
   } else {
-    // Allow dimmers to operate if the cover is open or ready.
-    isDimmerActive =
-        (currentDimmerValue_1 > 0 /* || currentDimmerValue_2 > 0 */);
-
-    // Set the Alpaca Calibrator State
-    if (isDimmerActive) {
-      calibratorState_1 = calibratorReady; // It's currently running (ON)
-    } else {
-      calibratorState_1 =
-          calibratorReady; // It's currently OFF, but ready to be turned ON
-    }
+    snprintf(out, size, "%s-%d", deviceUniqueID.c_str(), device);
   }
 }
-
 void loadSettings() { // keep
   preferences.begin("flatcat", false);
   currentSettings.hostname =
@@ -183,14 +72,84 @@ void loadSettings() { // keep
   currentSettings.ip = preferences.getString("ip", "192.168.1.150");
   currentSettings.gateway = preferences.getString("gateway", "192.168.1.1");
   currentSettings.subnet = preferences.getString("subnet", "255.255.255.0");
-  currentSettings.title1 = preferences.getString("title1", "FlatCat");
-  currentSettings.title2 = preferences.getString("title2", "Scope 2");
+  for (int i = 0; i < MAX_COVER_CALIBRATORS; i++) {
+    char key[12];
+    snprintf(key, sizeof(key), "title%d", i + 1);
+    currentSettings.title[i] = preferences.getString(
+        key, i == 0 ? String("FlatCat") : "Scope " + String(i + 1));
+  }
+  currentSettings.deviceCount = constrain(preferences.getInt("deviceCount", 1),
+                                          1, MAX_COVER_CALIBRATORS);
+  currentSettings.rampTimeMs =
+      constrain(preferences.getInt("rampMs", 500), 0, EL_MAX_RAMP_MS);
+  currentSettings.servoSpeed =
+      constrain(preferences.getInt("srvSpeed", 60), 1, SERVO_PROFILE_LIMIT);
+  currentSettings.servoAccel =
+      constrain(preferences.getInt("srvAccel", 120), 1, SERVO_PROFILE_LIMIT);
+  currentSettings.servoDecel =
+      constrain(preferences.getInt("srvDecel", 120), 1, SERVO_PROFILE_LIMIT);
+  currentSettings.stallMarginPct =
+      constrain(preferences.getInt("stallMargin", 50), 0, 500);
+  currentSettings.elHalfLifeHours =
+      constrain(preferences.getInt("elHalfLife", 0), 0, 100000);
+  for (int i = 0; i < MAX_COVER_CALIBRATORS; i++) {
+    char key[12];
+    snprintf(key, sizeof(key), "photoFull%d", i + 1);
+    currentSettings.photoFullScaleMv[i] = max(preferences.getInt(key, 0), 0);
+    snprintf(key, sizeof(key), "groups%d", i + 1);
+    currentSettings.groups[i] = preferences.getString(key, "");
+  }
+  currentSettings.groupKey = preferences.getString("groupKey", "");
+  currentSettings.mqttHost = preferences.getString("mqttHost", "");
+  currentSettings.mqttPort =
+      constrain(preferences.getInt("mqttPort", 1883), 1, 65535);
+  currentSettings.mqttUser = preferences.getString("mqttUser", "");
+  currentSettings.mqttPassword = preferences.getString("mqttPass", "");
+  currentSettings.mqttTopic = preferences.getString("mqttTopic", "");
   currentSettings.gmtOffset = preferences.getLong("gmtOffset", -18000);
   currentSettings.daylightOffset = preferences.getInt("daylightOffset", 3600);
   preferences.end();
+  loadBrightnessPresets();
+  invalidateAlpacaResponseCache(); // Titles and hostname are baked in there
+  updateAlpacaMdnsRecords();       // ...and in the mDNS TXT records
   // Serial.println("Loaded all settings.");
 }
 
+// --- AP (Captive Portal) Routes ---
+static const HttpRoute apRoutes[] = {
+    {"/scan", HTTP_GET, handleScan},
+    {"/savewifi", HTTP_POST, handleSaveWifi},
+};
+
+// --- Main Server Routes (Alpaca is matched by prefix after these) ---
+// The per-column UI routes (/sliderN, /openN, /closeN) are listed one by
+// one below; add rows for every new column when raising the device limit.
+static_assert(MAX_COVER_CALIBRATORS == 2,
+              "mainRoutes lists /sliderN, /openN, /closeN for 2 columns");
+static const HttpRoute mainRoutes[] = {
+    {"/", HTTP_GET, handleRoot},
+    {"/settings", HTTP_GET, handleSettings},
+    {"/gettime", HTTP_GET, handleGetTime},
+    {"/slider1", HTTP_GET, handleSlider},
+    {"/slider2", HTTP_GET, handleSlider},
+
+    // --- Essential Web UI Routes ---
+    {"/open1", HTTP_GET, handleOpen}, // One per column, see the
+    {"/open2", HTTP_GET, handleOpen}, // static_assert above
+    {"/close1", HTTP_GET, handleClose},
+    {"/close2", HTTP_GET, handleClose},
+    {"/getallstatus", HTTP_GET, handleGetAllStatus},
+    {"/events", HTTP_GET, handleEventStream},
+    {"/ws", HTTP_GET, handleWebSocket},
+    {"/getsettings", HTTP_GET, handleGetSettings},
+    {"/save", HTTP_POST, handleSave},
+    {"/sequence/start", HTTP_POST, handleSequenceStart},
+    {"/sequence/abort", HTTP_POST, handleSequenceAbort},
+    {"/sequencestatus", HTTP_GET, handleSequenceStatus},
+    {"/getpresets", HTTP_GET, handleGetPresets},
+    {"/savepresets", HTTP_POST, handleSavePresets},
+};
+
 void startApMode() { // keep
   // Serial.println("No saved credentials. Starting Access Point mode...");
   WiFi.softAP(ap_ssid);
@@ -200,11 +159,8 @@ void startApMode() { // keep
 
   dnsServer.start(53, "*", apIP);
 
-  server.onNotFound(handleNotFound);
-  server.on("/scan", HTTP_GET, handleScan);
-  server.on("/savewifi", HTTP_POST, handleSaveWifi);
-
-  server.begin();
+  registerHttpRoutes(apRoutes, sizeof(apRoutes) / sizeof(apRoutes[0]));
+  server.begin(); // The captive portal always uses the stock WebServer
   // Serial.println("AP Mode web server started.");
 }
 
@@ -233,6 +189,7 @@ void startMainServer() { // keep
     // Serial.println("mDNS responder started. Hostname: " +
     // currentSettings.hostname);
     MDNS.addService("http", "tcp", 80);
+    startAlpacaMdns(); // _alpaca._tcp with the device list in TXT records
   } else {
     // Serial.println("Error starting mDNS!");
   }
@@ -243,23 +200,16 @@ void startMainServer() { // keep
 
   // --- Start Alpaca Discovery Service (UDP) ---
   startAlpacaDiscovery();
+  startMqtt(); // Its own task connects once Wi-Fi is up
+  buildAlpacaResponseCache(); // Serialize the constant responses up front
 
-  // --- Main Server Routes (Only essential routes remain for this module) ---
-  server.on("/", HTTP_GET, handleRoot);
-  server.on("/settings", HTTP_GET, handleSettings);
-  server.on("/gettime", HTTP_GET, handleGetTime);
-  server.on("/slider1", HTTP_GET, handleSlider1);    // Example control route
-  server.on("/test/move", HTTP_GET, handleTestMove); // <-- NEW DEBUG ROUTE
-
-  // --- Essential Web UI Routes ---
-  server.on("/open1", HTTP_GET, handleOpen1);
-  server.on("/close1", HTTP_GET, handleClose1);
-  server.on("/getallstatus", HTTP_GET, handleGetAllStatus); // Fixed to match JS
-  server.on("/getsettings", HTTP_GET, handleGetSettings); // Added missing route
-  server.on("/save", HTTP_POST, handleSave);
-
-  server.onNotFound(handleNotFound);
+  // --- Main Server Routes ---
+  registerHttpRoutes(mainRoutes, sizeof(mainRoutes) / sizeof(mainRoutes[0]));
 
+#if FLATCAT_EVENT_HTTP_SERVER
+  startHttpEventServer();
+#else
   server.begin();
+#endif
   // Serial.println("Main web server started.");
 }
@@ -0,0 +1,444 @@
+// cover_motion.cpp
+
+#include "flatcat.h"
+
+// ================================================================
+// --- COVER MOTION ENGINE ---
+// ================================================================
+// Open/close requests only start a move and return; updateCoverStatus() and
+// checkAndStopServo() run in the control task and finish it. The servo is not
+// sent straight to its end angle: a ServoProfile plans an S-curve move
+// (accelerate, cruise, decelerate) and a 50 Hz esp_timer steps the pulse
+// width along it, so the cap starts and stops gently and the current draw
+// stays flat. Everything in
+// this file is called from the control task only (see tasks.cpp), except
+// initCoverCalibrators(), which setup() runs before the tasks start.
+
+// Margin on top of the planned move time while no travel time has been
+// learned yet. If the target sensor has not reported by then the move is
+// ended anyway.
+const unsigned long coverMoveTimeoutMs = 2000;
+
+// The sensor level must hold this long after its last edge before an
+// ISR stop is accepted; shorter blips are treated as glitches.
+#define END_STOP_DEBOUNCE_US 2000
+
+// Most ticks stopServoProfile() sleeps waiting for a running timer callback
+#define SERVO_STOP_WAIT_TICKS 5
+
+static esp_timer_handle_t servoProfileTimer = nullptr;
+
+// Set while the timer callback is stepping profiles. Together with the
+// profile's 'running' flag this lets the control task take the servo back
+// without a lock (see stopServoProfile()).
+static std::atomic<bool> servoProfileBusy{false};
+
+// ----------------------------------------------------------------
+// --- S-CURVE PROFILE ---
+// Velocity rises along a raised cosine over the accel phase, holds at the
+// peak speed, then falls along a raised cosine. Acceleration is therefore
+// zero at both ends of each ramp (no jerk spike), and its average equals the
+// configured value. Short moves that cannot reach the cruise speed become a
+// pure accel/decel move with a lower peak.
+// ----------------------------------------------------------------
+static void planServoProfile(ServoProfile &profile, float from, float to) {
+  float speed = max(currentSettings.servoSpeed, 1);
+  float accel = max(currentSettings.servoAccel, 1);
+  float decel = max(currentSettings.servoDecel, 1);
+  float distance = fabsf(to - from);
+
+  // Distance covered by the two ramps at full speed
+  float rampDistance =
+      speed * speed / (2 * accel) + speed * speed / (2 * decel);
+  if (distance < rampDistance) {
+    speed = sqrtf(2 * distance * accel * decel / (accel + decel));
+  }
+
+  profile.startAngle = from;
+  profile.distance = to - from;
+  profile.peakSpeed = speed;
+  profile.accelTime = (speed > 0) ? speed / accel : 0;
+  profile.decelTime = (speed > 0) ? speed / decel : 0;
+  float cruiseDistance =
+      distance - speed * (profile.accelTime + profile.decelTime) / 2;
+  profile.cruiseTime = (speed > 0) ? max(cruiseDistance, 0.0f) / speed : 0;
+}
+
+static float servoProfileDuration(const ServoProfile &profile) {
+  return profile.accelTime + profile.cruiseTime + profile.decelTime;
+}
+
+// Distance travelled t seconds into the move (always >= 0)
+static float servoProfilePosition(const ServoProfile &profile, float t) {
+  const float v = profile.peakSpeed;
+  const float ta = profile.accelTime, tc = profile.cruiseTime;
+  const float td = profile.decelTime;
+  const float accelDistance = v * ta / 2;
+
+  if (t <= 0)
+    return 0;
+  if (t < ta)
+    return v / 2 * (t - ta / PI * sinf(PI * t / ta));
+  if (t < ta + tc)
+    return accelDistance + v * (t - ta);
+  if (t < ta + tc + td) {
+    float u = t - ta - tc;
+    return accelDistance + v * tc + v / 2 * (u + td / PI * sinf(PI * u / td));
+  }
+  return fabsf(profile.distance);
+}
+
+static int angleToMicroseconds(float angle) {
+  return SERVO_MIN_US + (int)(angle * (SERVO_MAX_US - SERVO_MIN_US) / 180.0f);
+}
+
+// esp_timer callback, every SERVO_PROFILE_PERIOD_US. While a profile runs it
+// is the only code that writes to that device's servo.
+static void servoProfileTick(void *arg) {
+  servoProfileBusy.store(true);
+  int64_t now = esp_timer_get_time();
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    CoverCalibratorDevice &dev = coverCalibrators[i];
+    ServoProfile &profile = dev.profile;
+    if (!profile.running.load()) {
+      continue;
+    }
+    float t = (now - profile.startUs) / 1000000.0f;
+    bool done = t >= servoProfileDuration(profile);
+    float travelled = servoProfilePosition(profile, t);
+    float angle = profile.startAngle +
+                  (profile.distance < 0 ? -travelled : travelled);
+    dev.servo.writeMicroseconds(angleToMicroseconds(angle));
+    profile.angleCenti.store((int)(angle * 100));
+    if (done) {
+      profile.running.store(false);
+    }
+  }
+  servoProfileBusy.store(false);
+}
+
+// Takes the servo back from the timer: after this returns the callback will
+// not touch this device again until the next startServoProfile(). A tick
+// that already saw 'running' takes microseconds to finish; sleep rather
+// than spin while it does (it may run on the other core), and give up after
+// a few ticks so a stuck timer task can never hang the control task.
+static void stopServoProfile(CoverCalibratorDevice &dev) {
+  dev.profile.running.store(false);
+  for (int i = 0; servoProfileBusy.load() && i < SERVO_STOP_WAIT_TICKS; i++) {
+    vTaskDelay(1);
+  }
+}
+
+static void startServoProfile(CoverCalibratorDevice &dev, float target) {
+  stopServoProfile(dev); // Retarget: start from wherever it got to
+  float from = dev.profile.angleCenti.load() / 100.0f;
+  planServoProfile(dev.profile, from, target);
+  dev.profile.startUs = esp_timer_get_time();
+  dev.profile.running.store(true); // Hand the servo to the timer
+}
+
+// ----------------------------------------------------------------
+// --- END-STOP INTERRUPTS ---
+// Each fitted Hall sensor raises an interrupt when the magnet arrives (the
+// pin falls). If the cap is travelling towards that sensor, the ISR stops
+// the cap on the spot: it routes the servo pin away from its LEDC channel
+// (the pulse train ends mid-frame) and takes the profile off the timer.
+// The control task then checks the sensor is still active after
+// END_STOP_DEBOUNCE_US (glitch filter) before ending the move, or resumes
+// it if the edge was noise.
+// ----------------------------------------------------------------
+struct EndStopSensor {
+  CoverCalibratorDevice *dev;
+  int pin;
+};
+static EndStopSensor endStopSensors[MAX_COVER_CALIBRATORS * 2];
+
+static void IRAM_ATTR onEndStopEdge(void *arg) {
+  EndStopSensor *sensor = (EndStopSensor *)arg;
+  CoverCalibratorDevice *dev = sensor->dev;
+  dev->stopEdgeUs = (uint32_t)esp_timer_get_time();
+  if (dev->armedStopPin.load() == sensor->pin) {
+    esp_rom_gpio_connect_out_signal(dev->servoPin, SIG_GPIO_OUT_IDX, false,
+                                    false);
+    dev->profile.running.store(false);
+    dev->armedStopPin.store(-1);
+    dev->stopCut = true;
+  }
+  notifyControlTaskFromISR();
+}
+
+static void attachEndStop(CoverCalibratorDevice &dev, int pin, int slot) {
+  if (pin < 0)
+    return;
+  endStopSensors[slot] = {&dev, pin};
+  attachInterruptArg(pin, onEndStopEdge, &endStopSensors[slot], FALLING);
+}
+
+// Sensor the current move should stop on, -1 if that side has none
+static int targetStopPin(const CoverCalibratorDevice &dev) {
+  return dev.movingToOpen ? dev.openStopPin : dev.closedStopPin;
+}
+
+/**
+ * @brief Reads how many devices are in use and brings their hardware into a
+ * known state: EL panel off, cap parked closed, sensor pull-ups on. Only the
+ * devices in use are touched, so the pins of an unused slot stay free.
+ */
+void initCoverCalibrators() {
+  preferences.begin("flatcat", true);
+  coverCalibratorCount = constrain(preferences.getInt("deviceCount", 1), 1,
+                                   MAX_COVER_CALIBRATORS);
+  preferences.end();
+
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    CoverCalibratorDevice &dev = coverCalibrators[i];
+    dev.servoAngle = closeAngle;
+    dev.coverState = coverClosed;
+    dev.dimmerValue = 0;
+    dev.dimmerActive = false;
+    dev.calibratorState = calibratorOff;
+    dev.elDuty = 0;
+    dev.rampActive = false;
+    dev.rampDone = false;
+    dev.rampMs = 0;
+    dev.rampStartMs = 0;
+    dev.dwellMs = 0;
+    dev.settleActive = false;
+    dev.settleStartMs = 0;
+    dev.photoFullScaleMv = 0;
+    lightLoopReset(dev.lightLoop);
+    dev.lightLoopMs = 0;
+    dev.elDutyMs = 0;
+    dev.elSavedDutyMs = 0;
+    dev.elAccountMs = 0;
+    dev.elFlushMs = 0;
+    dev.closedStopActive = false;
+    dev.openStopActive = false;
+    dev.movingToClose = false;
+    dev.movingToOpen = false;
+    dev.moveStartMs = 0;
+    dev.moveLimitMs = 0;
+    dev.expectedMoveMs = 0;
+    dev.moveStartUs = 0;
+    dev.moveFromEnd = false;
+    dev.coverFault = false;
+    dev.learnedTravelMs[0] = 0;
+    dev.learnedTravelMs[1] = 0;
+    dev.sequenceState = SEQUENCE_IDLE;
+    dev.sequenceStep = 0;
+    dev.sequenceStepCount = 0;
+    dev.sequenceDeadlineMs = 0;
+    dev.groupCounter = 0;
+    dev.groupStatus = GROUP_STATUS_NONE;
+    dev.groupLateUs = 0;
+    dev.profile.running.store(false);
+    dev.profile.angleCenti.store(dev.servoAngle * 100);
+
+    ledcAttachChannel(dev.elPin, EL_PWM_FREQUENCY, EL_PWM_RESOLUTION_BITS,
+                      dev.elChannel);
+    ledcWrite(dev.elPin, 0);
+
+    // Initial servo position, then stop sending signals
+    dev.servo.attach(dev.servoPin, SERVO_MIN_US, SERVO_MAX_US);
+    dev.servo.write(dev.servoAngle);
+    dev.servo.detach();
+
+    // Initialize Sensor Pins with Internal Pull-Up (A3213 requirement)
+    if (dev.closedStopPin >= 0)
+      pinMode(dev.closedStopPin, INPUT_PULLUP);
+    if (dev.openStopPin >= 0)
+      pinMode(dev.openStopPin, INPUT_PULLUP);
+    dev.armedStopPin.store(-1);
+    dev.stopCut = false;
+    dev.stopEdgeUs = 0;
+    attachEndStop(dev, dev.closedStopPin, i * 2);
+    attachEndStop(dev, dev.openStopPin, i * 2 + 1);
+  }
+
+  const esp_timer_create_args_t timerArgs = {
+      .callback = servoProfileTick,
+      .arg = nullptr,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = "servo-profile",
+      .skip_unhandled_events = true,
+  };
+  if (esp_timer_create(&timerArgs, &servoProfileTimer) == ESP_OK) {
+    esp_timer_start_periodic(servoProfileTimer, SERVO_PROFILE_PERIOD_US);
+  }
+}
+
+bool isCoverMoving(const CoverCalibratorDevice &dev) {
+  return dev.movingToOpen || dev.movingToClose;
+}
+
+CoverMoveResult startCoverMove(CoverCalibratorDevice &dev, bool open) {
+  // Error Check 1: Prevent operation if dimmer is ON
+  if (dev.dimmerActive) {
+    return COVER_MOVE_BLOCKED;
+  }
+
+  // Error Check 2: Check if already there (using the sensor flags)
+  if (!isCoverMoving(dev) &&
+      (open ? dev.openStopActive : dev.closedStopActive)) {
+    return COVER_MOVE_ALREADY_THERE;
+  }
+
+  // Only a move that starts on the opposite sensor measures the full travel
+  dev.moveFromEnd = !isCoverMoving(dev) &&
+                    (open ? dev.closedStopActive : dev.openStopActive);
+
+  // Attach, set flags, and start the profiled travel to the end angle. A
+  // move in the opposite direction is simply retargeted from where it is.
+  int angle = open ? openAngle : closeAngle;
+  if (dev.stopCut) {
+    dev.servo.detach(); // The ISR unrouted the pin; attach() reconnects it
+  }
+  if (!dev.servo.attached()) {
+    dev.servo.attach(dev.servoPin, SERVO_MIN_US, SERVO_MAX_US);
+  }
+  dev.movingToOpen = open;
+  dev.movingToClose = !open;
+  dev.coverState = coverMoving;
+  dev.stopCut = false;
+  startServoProfile(dev, angle);
+  dev.armedStopPin.store(targetStopPin(dev)); // Let the ISR stop it there
+  dev.servoAngle = angle;
+  dev.coverFault = false;
+  dev.moveStartMs = millis();
+  dev.moveStartUs = (uint32_t)esp_timer_get_time();
+
+  // Expected time and stall limit: from the learned travel time once there
+  // is one, otherwise from the planned profile plus a fixed margin
+  unsigned long planned =
+      (unsigned long)(servoProfileDuration(dev.profile) * 1000);
+  uint32_t learned = dev.learnedTravelMs[open ? 1 : 0];
+  if (learned > 0 && targetStopPin(dev) >= 0) {
+    dev.expectedMoveMs = learned;
+    dev.moveLimitMs =
+        learned + learned * currentSettings.stallMarginPct / 100;
+  } else {
+    dev.expectedMoveMs = planned;
+    dev.moveLimitMs = planned + coverMoveTimeoutMs;
+  }
+  return COVER_MOVE_STARTED;
+}
+
+// Common end of a move: stop the profile, power the servo off, clear flags
+static void endCoverMove(CoverCalibratorDevice &dev) {
+  dev.armedStopPin.store(-1);
+  dev.stopCut = false;
+  stopServoProfile(dev);
+  dev.servo.detach();
+  dev.servoAngle = dev.profile.angleCenti.load() / 100;
+  dev.movingToOpen = false;
+  dev.movingToClose = false;
+  updateCoverStatus(dev); // Confirm the final state from the sensors
+}
+
+// The target sensor confirmed the end of the move at 'edgeUs'
+static void finishCoverMove(CoverCalibratorDevice &dev, uint32_t edgeUs) {
+  bool open = dev.movingToOpen;
+  bool timeable = dev.moveFromEnd;
+  endCoverMove(dev);
+  if (timeable) {
+    recordTravelTime(dev, open, (edgeUs - dev.moveStartUs) / 1000);
+  }
+}
+
+void haltCover(CoverCalibratorDevice &dev) {
+  if (!isCoverMoving(dev)) {
+    return;
+  }
+  endCoverMove(dev); // Stops where it is; Open/Closed if on a sensor
+}
+
+// Sensor reads LOW when the magnet is present; a missing sensor never is
+static bool readStopSensor(int pin) {
+  return pin >= 0 && digitalRead(pin) == LOW;
+}
+
+/**
+ * @brief Checks the Hall sensors to determine the cover's absolute state.
+ * Uses the INPUT_PULLUP setup, meaning the sensor reads LOW when the magnet is
+ * present. While a move is in progress the state stays Moving.
+ */
+void updateCoverStatus(CoverCalibratorDevice &dev) {
+  dev.closedStopActive = readStopSensor(dev.closedStopPin);
+  dev.openStopActive = readStopSensor(dev.openStopPin);
+
+  if (isCoverMoving(dev)) {
+    dev.coverState = coverMoving;
+  } else if (dev.coverFault) {
+    dev.coverState = coverError; // Stalled; cleared by the next move
+  } else if (dev.closedStopActive && !dev.openStopActive) {
+    dev.coverState = coverClosed;
+  } else if (dev.openStopActive && !dev.closedStopActive) {
+    dev.coverState = coverOpen;
+  } else if (dev.closedStopPin < 0 && dev.openStopPin < 0) {
+    // No sensors at all: trust the last commanded position
+    if (dev.servoAngle == openAngle) {
+      dev.coverState = coverOpen;
+    } else if (dev.servoAngle == closeAngle) {
+      dev.coverState = coverClosed;
+    } else {
+      dev.coverState = coverReady; // Halted part way
+    }
+  } else {
+    dev.coverState = coverReady; // Between sensors, or both active (Unknown)
+  }
+}
+
+/**
+ * @brief Ends the current move once the target sensor reports (or, with no
+ * sensor on that side, once the profile has finished). A move that runs past
+ * its limit (learned time plus the stall margin) with a sensor on the target
+ * side is a stall: the servo is detached and the cover reports Error.
+ */
+void checkAndStopServo(CoverCalibratorDevice &dev) {
+  if (!isCoverMoving(dev)) {
+    return;
+  }
+
+  int targetPin = targetStopPin(dev);
+
+  // The end-stop ISR already stopped the cap: confirm once the sensor has
+  // been steady for the debounce time, or resume if it was a glitch.
+  if (dev.stopCut) {
+    uint32_t sinceEdge = (uint32_t)esp_timer_get_time() - dev.stopEdgeUs;
+    if (sinceEdge < END_STOP_DEBOUNCE_US) {
+      return; // Still settling
+    }
+    bool active = dev.movingToOpen ? dev.openStopActive : dev.closedStopActive;
+    if (active) {
+      finishCoverMove(dev, dev.stopEdgeUs); // Stopped on the magnet
+      return;
+    }
+    dev.stopCut = false;
+    dev.servo.detach(); // Re-attaching reconnects the pin to LEDC
+    dev.servo.attach(dev.servoPin, SERVO_MIN_US, SERVO_MAX_US);
+    startServoProfile(dev, dev.servoAngle);
+    dev.armedStopPin.store(targetPin);
+    return;
+  }
+
+  if (targetPin >= 0) {
+    // Missed interrupt: the polled sensor flag still ends the move
+    if (dev.movingToOpen ? dev.openStopActive : dev.closedStopActive) {
+      finishCoverMove(dev, (uint32_t)esp_timer_get_time());
+      return;
+    }
+  } else if (!dev.profile.running.load()) {
+    endCoverMove(dev); // No sensor on this side: trust the profile
+    return;
+  }
+
+  if (millis() - dev.moveStartMs < dev.moveLimitMs) {
+    return;
+  }
+
+  // Out of time: jammed or lost. Cut the stall current and report it
+  // (CoverState Error, see updateCoverStatus()).
+  endCoverMove(dev);
+  dev.coverFault = targetPin >= 0;
+  updateCoverStatus(dev);
+}
@@ -0,0 +1,63 @@
+// device_state.cpp
+
+#include "flatcat.h"
+
+// ================================================================
+// --- DEVICE STATE SNAPSHOT ---
+// ================================================================
+// The control task owns the state fields of coverCalibrators[] and publishes
+// each device here after every poll and every command. Handlers read the
+// whole set at once, so devicestate can never combine a cover state from
+// before a move with a brightness from after it.
+
+static Seqlock<DeviceSnapshot> deviceSnapshotLocks[MAX_COVER_CALIBRATORS];
+static DeviceSnapshot lastPublished[MAX_COVER_CALIBRATORS] = {}; // Writer copy
+
+/**
+ * @brief Publishes a device's current state if anything changed since the
+ * last call. Its generation only moves when the contents do.
+ */
+void publishDeviceSnapshot(int device) {
+  const CoverCalibratorDevice &dev = coverCalibrators[device];
+  DeviceSnapshot &last = lastPublished[device];
+
+  DeviceSnapshot next;
+  memset(&next, 0, sizeof(next)); // Padding too, for the memcmp below
+  next.coverState = dev.coverState;
+  next.calibratorState = dev.calibratorState;
+  next.brightness = dev.dimmerValue;
+  next.servoAngle = dev.servoAngle;
+  next.dimmerActive = dev.dimmerActive;
+  next.calibratorChanging = isCalibratorChanging(dev);
+  next.closedStopActive = dev.closedStopActive;
+  next.openStopActive = dev.openStopActive;
+  next.moving = isCoverMoving(dev);
+  next.coverFault = dev.coverFault;
+  next.moveStartMs = next.moving ? dev.moveStartMs : 0;
+  next.expectedMoveMs = next.moving ? dev.expectedMoveMs : 0;
+  next.learnedOpenMs = dev.learnedTravelMs[1];
+  next.learnedCloseMs = dev.learnedTravelMs[0];
+  next.elCentiHours = (uint32_t)(elOnHours(dev) * 100);
+  next.lightLoopEnabled = isLightLoopEnabled(dev);
+  next.lightLoopLocked = dev.lightLoop.converged;
+  next.sequenceState = dev.sequenceState;
+  next.sequenceStep = dev.sequenceStep;
+  next.sequenceStepCount = dev.sequenceStepCount;
+  next.sequenceDeadlineMs = dev.sequenceDeadlineMs;
+  next.groupCounter = dev.groupCounter;
+  next.groupStatus = dev.groupStatus;
+  next.groupLateUs = dev.groupLateUs;
+
+  next.generation = last.generation;
+  if (last.generation != 0 && memcmp(&next, &last, sizeof(next)) == 0) {
+    return; // Nothing new
+  }
+  next.generation = last.generation + 1;
+
+  last = next;
+  deviceSnapshotLocks[device].write(next);
+}
+
+void readDeviceSnapshot(int device, DeviceSnapshot &snapshot) {
+  deviceSnapshotLocks[device].read(snapshot);
+}
@@ -0,0 +1,97 @@
+// el_aging.cpp
+
+#include "flatcat.h"
+
+// ================================================================
+// --- EL PANEL AGING ---
+// ================================================================
+// EL panels lose output with use, roughly in proportion to how hard they are
+// driven. Each panel's on-time is accumulated weighted by its duty (an hour
+// at full counts as one hour, an hour at a quarter duty as a quarter) and
+// kept in NVS. With a half-life configured, the duty for every brightness is
+// scaled up by 1 + hours / halfLife, the inverse of a hyperbolic decay that
+// halves the output at the half-life, so a given brightness gives the same
+// light for as long as there is duty headroom left.
+// Called from the control task only.
+
+// The accumulated time is written back in batches, not on every change, to
+// spare the flash: at most once per interval while lit, and once when the
+// panel is switched off. A reboot loses at most one interval.
+#define EL_AGING_FLUSH_MS (15UL * 60 * 1000)
+#define EL_AGING_MS_PER_HOUR 3600000.0
+
+// The global 'preferences' belongs to the network task's handlers
+static Preferences agingPrefs;
+
+static void agingKey(int device, char *key, size_t size) {
+  snprintf(key, size, "elDutyMs%d", device);
+}
+
+static void flushElAging(CoverCalibratorDevice &dev) {
+  if (dev.elDutyMs == dev.elSavedDutyMs) {
+    return;
+  }
+  char key[16];
+  agingKey(&dev - coverCalibrators, key, sizeof(key));
+  agingPrefs.begin("flatcat-el", false);
+  agingPrefs.putULong64(key, dev.elDutyMs);
+  agingPrefs.end();
+  dev.elSavedDutyMs = dev.elDutyMs;
+  dev.elFlushMs = millis();
+}
+
+/**
+ * @brief Loads the accumulated on-time of every device in use.
+ */
+void loadElAging() {
+  agingPrefs.begin("flatcat-el", true);
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    CoverCalibratorDevice &dev = coverCalibrators[i];
+    char key[16];
+    agingKey(i, key, sizeof(key));
+    dev.elDutyMs = agingPrefs.getULong64(key, 0);
+    dev.elSavedDutyMs = dev.elDutyMs;
+    dev.elAccountMs = millis();
+    dev.elFlushMs = millis();
+  }
+  agingPrefs.end();
+}
+
+// Full-duty equivalent hours the panel has been lit
+float elOnHours(const CoverCalibratorDevice &dev) {
+  return (float)(dev.elDutyMs / (EL_PWM_DUTY_MAX * EL_AGING_MS_PER_HOUR));
+}
+
+// Duty multiplier that undoes the modelled decay, 1.0 when disabled
+float elAgingFactor(const CoverCalibratorDevice &dev) {
+  if (currentSettings.elHalfLifeHours <= 0) {
+    return 1.0f;
+  }
+  return 1.0f + elOnHours(dev) / currentSettings.elHalfLifeHours;
+}
+
+/**
+ * @brief Adds the time since the last call at the current duty, and writes
+ * it back when a batch is due. When a batch lands the lit panel's duty is
+ * refreshed, so the compensation follows the aging without a new command.
+ */
+void accountElOnTime(CoverCalibratorDevice &dev) {
+  unsigned long now = millis();
+  dev.elDutyMs += (uint64_t)(now - dev.elAccountMs) * dev.elDuty;
+  dev.elAccountMs = now;
+
+  bool pending = dev.elDutyMs != dev.elSavedDutyMs;
+  bool due = dev.elDuty == 0 || now - dev.elFlushMs >= EL_AGING_FLUSH_MS;
+  if (pending && due) {
+    flushElAging(dev);
+    refreshElOutput(dev);
+  }
+}
+
+// A new panel was fitted: start counting from zero
+void resetElAging(CoverCalibratorDevice &dev) {
+  dev.elDutyMs = 0;
+  dev.elSavedDutyMs = 1; // Force the write
+  flushElAging(dev);
+  refreshElOutput(dev);
+}
@@ -0,0 +1,283 @@
+// el_dimmer.cpp
+
+#include "flatcat.h"
+#include "driver/ledc.h" // ledc_fade_stop(), not wrapped by the Arduino core
+
+// ================================================================
+// --- EL PANEL DIMMER ---
+// ================================================================
+// Brightness changes are handed to the LEDC hardware fade engine, which walks
+// the duty to the new value on its own over currentSettings.rampTimeMs; the
+// CPU only starts the fade and gets an interrupt when it ends. While a ramp
+// runs, and for an optional dwell after it (a preset's settle time), the
+// calibrator reports NotReady / CalibratorChanging, so clients can wait for
+// the light to settle instead of sleeping a fixed time. A new value that
+// arrives mid-ramp stops the fade where it is and fades on from there.
+// Called from the control task only (see tasks.cpp).
+
+// Extra time allowed past the ramp length before we stop waiting for the
+// fade-end interrupt
+#define EL_RAMP_GRACE_MS 200
+
+// Photodiode regulation: one regulator update per period, each from an
+// average of several ADC reads (the panel PWM ripple averages out here and
+// in the loop's IIR filter)
+#define LIGHT_LOOP_PERIOD_MS 5
+#define LIGHT_LOOP_OVERSAMPLE 16
+#define LIGHT_CAPTURE_SAMPLES 256
+
+// A captured reference is stored from here (control task), through its own
+// handle as the aging and travel stores do; same key as the settings page
+static Preferences lightPrefs;
+
+// ----------------------------------------------------------------
+// Alpaca brightness -> LEDC duty, generated at compile time. Brightness is
+// treated as perceived lightness (CIE 1976 L*), so the duty rises slowly at
+// the dim end where narrowband flats need the finest control. Every non-zero
+// brightness gets at least one duty step, so "on" is never dark.
+// ----------------------------------------------------------------
+static constexpr std::array<uint16_t, EL_MAX_BRIGHTNESS + 1>
+buildElDutyTable() {
+  std::array<uint16_t, EL_MAX_BRIGHTNESS + 1> table = {};
+  for (int b = 0; b <= EL_MAX_BRIGHTNESS; b++) {
+    double lightness = 100.0 * b / EL_MAX_BRIGHTNESS;
+    double t = (lightness + 16.0) / 116.0;
+    double luminance = (lightness <= 8.0) ? lightness / 903.3 : t * t * t;
+    uint32_t duty = (uint32_t)(luminance * EL_PWM_DUTY_MAX + 0.5);
+    if (b > 0 && duty == 0)
+      duty = 1;
+    table[b] = duty;
+  }
+  return table;
+}
+
+static constexpr std::array<uint16_t, EL_MAX_BRIGHTNESS + 1> elDutyTable =
+    buildElDutyTable();
+static_assert(elDutyTable[0] == 0 &&
+                  elDutyTable[EL_MAX_BRIGHTNESS] == EL_PWM_DUTY_MAX,
+              "EL duty table must span off to full on");
+static_assert(EL_PWM_RESOLUTION_BITS <= 16, "Duty table holds 16-bit values");
+
+// LEDC fade-end interrupt
+static void IRAM_ATTR onElFadeDone(void *arg) {
+  CoverCalibratorDevice *dev = (CoverCalibratorDevice *)arg;
+  dev->rampDone = true;
+  notifyControlTaskFromISR(); // Report the settle without waiting a poll
+}
+
+bool isLightLoopEnabled(const CoverCalibratorDevice &dev) {
+  return dev.photoPin >= 0 && dev.photoFullScaleMv > 0;
+}
+
+// Ramping, dwelling, or the regulator has not locked on yet
+bool isCalibratorChanging(const CoverCalibratorDevice &dev) {
+  return dev.rampActive || dev.settleActive ||
+         (isLightLoopEnabled(dev) && dev.dimmerActive &&
+          !dev.lightLoop.converged);
+}
+
+static void refreshCalibratorState(CoverCalibratorDevice &dev) {
+  if (isCalibratorChanging(dev)) {
+    dev.calibratorState = calibratorNotReady; // Still changing
+  } else if (dev.dimmerActive) {
+    dev.calibratorState = calibratorReady; // On and stable
+  } else {
+    dev.calibratorState = calibratorOff;
+  }
+}
+
+// Tabled duty, scaled up for the panel's age (see el_aging.cpp)
+static uint32_t compensatedElDuty(const CoverCalibratorDevice &dev,
+                                  int brightness) {
+  float duty = elDutyTable[brightness] * elAgingFactor(dev);
+  return (uint32_t)min(duty + 0.5f, (float)EL_PWM_DUTY_MAX);
+}
+
+// Stops a running hardware fade where it is and returns the duty it got to.
+// Arduino channel numbers map to LEDC groups of 8, as in esp32-hal-ledc.
+static uint32_t stopElFade(CoverCalibratorDevice &dev) {
+  ledc_fade_stop((ledc_mode_t)(dev.elChannel / 8),
+                 (ledc_channel_t)(dev.elChannel % 8));
+  dev.rampActive = false;
+  return ledcRead(dev.elPin);
+}
+
+// Holds NotReady for the dwell once the light has reached its new level
+static void startElSettle(CoverCalibratorDevice &dev) {
+  dev.settleActive = dev.dwellMs > 0;
+  dev.settleStartMs = millis();
+}
+
+static void startElRamp(CoverCalibratorDevice &dev, int brightness,
+                        int rampMs, int dwellMs) {
+  uint32_t from = dev.rampActive ? stopElFade(dev) : dev.elDuty;
+  uint32_t to = compensatedElDuty(dev, brightness);
+  dev.elDuty = to;
+  dev.rampMs = rampMs;
+  dev.dwellMs = dwellMs;
+  dev.settleActive = false;
+  lightLoopReset(dev.lightLoop); // Regulates again once the ramp is done
+
+  if (dev.rampMs <= 0 || from == to) {
+    ledcWrite(dev.elPin, to); // No ramp configured, or nothing to ramp
+    dev.rampActive = false;
+    startElSettle(dev);
+    return;
+  }
+
+  dev.rampDone = false;
+  dev.rampActive = true;
+  dev.rampStartMs = millis();
+  if (!ledcFadeWithInterruptArg(dev.elPin, from, to, dev.rampMs, onElFadeDone,
+                                &dev)) {
+    ledcWrite(dev.elPin, to); // Fade engine refused; fall back to a step
+    dev.rampActive = false;
+    startElSettle(dev);
+  }
+}
+
+/**
+ * @brief Sets a panel's brightness (0..maxBrightness), ramping to it over
+ * 'rampMs' (-1 for the rampTimeMs setting) and then holding NotReady for
+ * 'dwellMs'. A ramp in progress is cut short and the new one starts from
+ * the light it had reached. The panel counts as lit (dimmerActive, which
+ * locks the cover) until its output is actually dark.
+ */
+void setDimmerValue(CoverCalibratorDevice &dev, int brightness, int rampMs,
+                    int dwellMs) {
+  if (rampMs < 0) {
+    rampMs = currentSettings.rampTimeMs;
+  }
+
+  // 1. Clamp the brightness value to the valid range (0 to MaxBrightness).
+  brightness = constrain(brightness, 0, maxBrightness);
+
+  // 2. Update the target (reported at once)
+  dev.dimmerValue = brightness;
+
+  // 3. Ramp to the tabled LEDC duty from wherever the output is now
+  startElRamp(dev, brightness, rampMs, dwellMs);
+
+  // 4. Lit while on, or while still fading down to dark
+  dev.dimmerActive = brightness > 0 || dev.rampActive;
+  refreshCalibratorState(dev);
+}
+
+/**
+ * @brief Re-applies the lit panel's brightness after the aging compensation
+ * changed. The step is tiny, so it is written directly; a running ramp
+ * picks the new factor up with the next value.
+ */
+void refreshElOutput(CoverCalibratorDevice &dev) {
+  if (dev.rampActive || !dev.dimmerActive || isLightLoopEnabled(dev)) {
+    return; // The regulator picks the factor up in its feed-forward
+  }
+  uint32_t duty = compensatedElDuty(dev, dev.dimmerValue);
+  if (duty != dev.elDuty) {
+    ledcWrite(dev.elPin, duty);
+    dev.elDuty = duty;
+  }
+}
+
+// ----------------------------------------------------------------
+// --- Closed-loop light output ---
+// With a photodiode fitted and referenced, the tabled duty is only the
+// feed-forward: once a ramp is done the regulator (light_loop.h) trims the
+// duty until the photodiode reads the flux that brightness stands for,
+// whatever the temperature, supply or panel age. The calibrator reports
+// NotReady / CalibratorChanging until it has locked on.
+// ----------------------------------------------------------------
+void initLightLoops() {
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    CoverCalibratorDevice &dev = coverCalibrators[i];
+    if (dev.photoPin >= 0 && digitalPinToAnalogChannel(dev.photoPin) < 0) {
+      dev.photoPin = -1; // Not an ADC pin on this board: run open loop
+    }
+    dev.photoFullScaleMv = currentSettings.photoFullScaleMv[i];
+  }
+}
+
+static float readPhotoMv(const CoverCalibratorDevice &dev, int samples) {
+  uint32_t sum = 0;
+  for (int i = 0; i < samples; i++) {
+    sum += analogReadMilliVolts(dev.photoPin);
+  }
+  return (float)sum / samples;
+}
+
+// Flux the photodiode should read at this brightness, fraction of full scale
+static float lightTarget(int brightness) {
+  return (float)elDutyTable[brightness] / EL_PWM_DUTY_MAX;
+}
+
+static void runLightLoop(CoverCalibratorDevice &dev) {
+  if (!isLightLoopEnabled(dev) || dev.rampActive || !dev.dimmerActive) {
+    return;
+  }
+  unsigned long now = millis();
+  if (now - dev.lightLoopMs < LIGHT_LOOP_PERIOD_MS) {
+    return;
+  }
+  dev.lightLoopMs = now;
+
+  float flux = readPhotoMv(dev, LIGHT_LOOP_OVERSAMPLE) / dev.photoFullScaleMv;
+  lightLoopFilter(dev.lightLoop, lightLoopDefaults, flux);
+  float feedForward =
+      (float)compensatedElDuty(dev, dev.dimmerValue) / EL_PWM_DUTY_MAX;
+  float duty = lightLoopUpdate(dev.lightLoop, lightLoopDefaults,
+                               lightTarget(dev.dimmerValue), feedForward);
+
+  uint32_t level = (uint32_t)(duty * EL_PWM_DUTY_MAX + 0.5f);
+  if (level != dev.elDuty) {
+    ledcWrite(dev.elPin, level);
+    dev.elDuty = level;
+  }
+}
+
+/**
+ * @brief Takes the light the lit panel gives right now as the reference
+ * for its brightness, which switches the regulator on, and stores it.
+ * @return The photodiode full-scale reading in mV, or -1 if there is no
+ * photodiode or the panel is not lit and steady.
+ */
+int captureLightReference(CoverCalibratorDevice &dev) {
+  if (dev.photoPin < 0 || !dev.dimmerActive || dev.rampActive) {
+    return -1;
+  }
+  float mv = readPhotoMv(dev, LIGHT_CAPTURE_SAMPLES);
+  float target = lightTarget(dev.dimmerValue);
+  if (mv < 1.0f || target <= 0) {
+    return -1; // Nothing on the photodiode
+  }
+  dev.photoFullScaleMv = mv / target;
+  lightLoopReset(dev.lightLoop);
+
+  int fullScaleMv = (int)(dev.photoFullScaleMv + 0.5f);
+  char key[12];
+  snprintf(key, sizeof(key), "photoFull%d", (int)(&dev - coverCalibrators) + 1);
+  lightPrefs.begin("flatcat", false);
+  lightPrefs.putInt(key, fullScaleMv);
+  lightPrefs.end();
+  return fullScaleMv;
+}
+
+/**
+ * @brief Ends a finished ramp (fade interrupt seen, or the ramp time plus a
+ * grace period passed) and starts the dwell, ends a finished dwell, and
+ * derives CalibratorState.
+ */
+void updateCalibratorStatus(CoverCalibratorDevice &dev) {
+  unsigned long limit = (unsigned long)dev.rampMs + EL_RAMP_GRACE_MS;
+  if (dev.rampActive &&
+      (dev.rampDone || millis() - dev.rampStartMs > limit)) {
+    dev.rampActive = false;
+    dev.dimmerActive = dev.dimmerValue > 0; // A fade to off is dark now
+    startElSettle(dev);
+  }
+  if (dev.settleActive &&
+      millis() - dev.settleStartMs >= (unsigned long)dev.dwellMs) {
+    dev.settleActive = false;
+  }
+  runLightLoop(dev);
+  refreshCalibratorState(dev);
+}
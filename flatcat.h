@@ -6,8 +6,11 @@
 // --- Standard Includes ---
 #include "esp_chip_info.h"
 #include "esp_mac.h"    // <-- Also useful for MAC-related functions
+#include "esp_rom_gpio.h" // End-stop ISR cuts the servo signal directly
 #include "esp_system.h" // <-- NEW: Required for esp_efuse_read_mac()
 #include <Arduino.h>
+#include <array>
+#include <atomic>
 #include <ArduinoJson.h>
 #include <DNSServer.h>
 #include <ESP32Servo.h>
@@ -16,6 +19,11 @@
 #include <WebServer.h>
 #include <WiFi.h>
 #include <WiFiUdp.h>
+#include <lwip/sockets.h> // Discovery sockets (IPv4 + IPv6)
+#include <mdns.h>         // Whole-set TXT updates for _alpaca._tcp
+#include <soc/gpio_sig_map.h>
+
+#include "light_loop.h" // Host-buildable photodiode regulator
 
 // --- HTML FILES ---
 #include "page_main.h"
@@ -28,13 +36,8 @@
 // ================================================================
 
 // --- HARDWARE PINS ---
-extern int elPin_1;
-// extern int elPin_2;
-extern int servoPin_1;
-// extern int servoPin_2;
+// (Per-device pins live in coverCalibrators[], see below)
 extern int factoryResetPin;
-extern int closedStopPin_1; // <-- NEW
-extern int openStopPin_1;
 
 // --- SERVO CONFIG / CONSTANTS ---
 extern int openAngle;
@@ -43,33 +46,355 @@ extern const int coverReady;
 extern const int coverOpen;
 extern const int coverClosed;
 extern const int coverMoving;
+extern const int coverError;
+extern const int calibratorOff;
 extern const int calibratorReady;
 extern const int calibratorNotReady;
 extern const int maxBrightness;
 
+// --- WEB SERVER ---
+// WebServer with by-reference access to the parsed request arguments, so the
+// Alpaca parameter scan does not copy every name and value into a String.
+class FlatcatWebServer : public WebServer {
+public:
+  FlatcatWebServer(int port) : WebServer(port) {}
+  const String &argNameRef(int i) const { return _currentArgs[i].key; }
+  const String &argValueRef(int i) const { return _currentArgs[i].value; }
+};
+
 // --- GLOBAL OBJECTS & STATE ---
-extern WebServer server;
-extern Servo myServo_1;
-// extern Servo myServo_2;
+extern FlatcatWebServer server;
 extern Preferences preferences;
 extern DNSServer dnsServer;
-extern WiFiUDP udp;
 extern const char *ntpServer;
 
 extern String currentTimeString;
 extern unsigned long lastTimeUpdate;
 extern long serverTransactionID;
-extern bool isDimmerActive;
-extern int currentServoAngle_1;
-// extern int currentServoAngle_2;
-extern int coverState_1;
-extern int currentDimmerValue_1;
-// extern int currentDimmerValue_2;
-extern int calibratorState_1;
-extern bool isClosedStopActive_1; // <-- NEW
-extern bool isOpenStopActive_1;   // <-- NEW
-extern bool isMovingToClose_1;    // <-- NEW
-extern bool isMovingToOpen_1;     // <-- NEW
+
+// --- EL PANEL DIMMER (LEDC) ---
+// The panels are driven straight from LEDC at high resolution; the Alpaca
+// brightness goes through a compile-time CIE lightness table (see
+// config_utilities.cpp), so equal brightness steps look equal and the dim end
+// gets the finest duty steps. Resolution and frequency trade off against
+// each other (80 MHz / 2^bits is the fastest possible): 14 bit allows up to
+// ~4.8 kHz, 12 bit ~19.5 kHz, 16 bit ~1.2 kHz.
+#define EL_PWM_RESOLUTION_BITS 14
+#define EL_PWM_FREQUENCY 4000   // Hz, far above any flat exposure time
+#define EL_MAX_BRIGHTNESS 1023  // Reported as Alpaca MaxBrightness
+#define EL_PWM_DUTY_MAX ((1u << EL_PWM_RESOLUTION_BITS) - 1)
+#define EL_MAX_RAMP_MS 10000    // Upper limit for the brightness ramp setting
+
+// --- SERVO MOTION PROFILE ---
+// Pulse range used for every cap servo (ESP32Servo's defaults for 0..180)
+#define SERVO_MIN_US 544
+#define SERVO_MAX_US 2400
+#define SERVO_PROFILE_PERIOD_US 20000 // One step per 50 Hz servo frame
+#define SERVO_PROFILE_LIMIT 720       // Max speed (deg/s) / accel (deg/s^2)
+
+// One planned cap move (see cover_motion.cpp). Planned by the control task,
+// then stepped by the profile timer while 'running' is set.
+struct ServoProfile {
+  float startAngle;
+  float distance;  // Signed, degrees
+  float peakSpeed; // deg/s
+  float accelTime; // Seconds in each phase
+  float cruiseTime;
+  float decelTime;
+  int64_t startUs;
+  std::atomic<bool> running;
+  std::atomic<int> angleCenti; // Last commanded angle x100
+};
+
+// --- FLAT SEQUENCES ---
+#define MAX_SEQUENCE_STEPS 32
+
+enum SequenceCoverAction {
+  SEQUENCE_COVER_NONE,
+  SEQUENCE_COVER_OPEN,
+  SEQUENCE_COVER_CLOSE
+};
+
+struct SequenceStep {
+  int8_t cover;       // SequenceCoverAction, done first
+  int16_t brightness; // -1 = leave the panel as it is
+  int16_t rampMs;     // -1 = the rampTimeMs setting
+  int32_t holdMs;     // Held this long once the ramp is done
+};
+
+enum SequenceState {
+  SEQUENCE_IDLE,    // Never started
+  SEQUENCE_COVER,   // Waiting for the step's cover move
+  SEQUENCE_HOLD,    // Ramping/holding until the step deadline
+  SEQUENCE_DONE,    // All steps run
+  SEQUENCE_ABORTED, // Stopped by a client or a manual command
+  SEQUENCE_FAILED   // Cover move refused or stalled
+};
+
+enum SequenceUploadResult {
+  SEQUENCE_UPLOAD_STARTED,
+  SEQUENCE_UPLOAD_PENDING, // Queued; starts when the control task takes it
+  SEQUENCE_UPLOAD_INVALID,
+  SEQUENCE_UPLOAD_BUSY
+};
+
+// --- COVER CALIBRATOR DEVICES ---
+// One entry per lens cap + flat panel pair, served as Alpaca CoverCalibrator
+// device N and shown as column N+1 in the web UI. Pins are fixed at build
+// time; how many of the entries are actually in use is a setting
+// (coverCalibratorCount). A stop pin of -1 means that sensor is not fitted.
+#define MAX_COVER_CALIBRATORS 2
+
+struct CoverCalibratorDevice {
+  // --- Hardware ---
+  int elPin;
+  int servoPin;
+  int closedStopPin;
+  int openStopPin;
+  int elChannel; // LEDC channel for the EL panel
+  int photoPin;  // ADC pin of the panel photodiode, -1 = not fitted
+  Servo servo;
+
+  // --- State (owned by the control task) ---
+  int servoAngle;
+  int coverState;
+  int dimmerValue; // Target brightness (reported even while ramping)
+  bool dimmerActive; // Panel lit, including a fade down to off
+  int calibratorState;
+  uint32_t elDuty;            // LEDC duty of the current/last ramp target
+  bool rampActive;            // Hardware fade running
+  volatile bool rampDone;     // Set by the fade-end interrupt
+  int rampMs;
+  unsigned long rampStartMs;
+  int dwellMs;                // NotReady this long after the ramp ends
+  bool settleActive;          // In the dwell after a ramp
+  unsigned long settleStartMs;
+  float photoFullScaleMv;     // Photodiode reading for full flux, 0 = loop off
+  LightLoopState lightLoop;   // Closed-loop output regulation
+  unsigned long lightLoopMs;  // Last regulator update
+  uint64_t elDutyMs;          // Lit time x duty, the panel's age (el_aging)
+  uint64_t elSavedDutyMs;     // Value last written to NVS
+  unsigned long elAccountMs;  // Last accounting pass
+  unsigned long elFlushMs;    // Last NVS write
+  bool closedStopActive;
+  bool openStopActive;
+  bool movingToClose;
+  bool movingToOpen;
+  unsigned long moveStartMs;
+  unsigned long moveLimitMs;    // Past this the move is a stall
+  unsigned long expectedMoveMs; // When the move should be done (ETA)
+  uint32_t moveStartUs;         // For timing against the ISR edge
+  bool moveFromEnd;             // Started on the opposite sensor: timeable
+  bool coverFault;              // Last move stalled; Error until next move
+  uint32_t learnedTravelMs[2];  // [0] close, [1] open; 0 = not learned yet
+  ServoProfile profile;
+
+  // --- Flat sequence progress (sequence.cpp) ---
+  int sequenceState; // SequenceState
+  int sequenceStep;  // Index of the running step
+  int sequenceStepCount;
+  unsigned long sequenceDeadlineMs; // millis() at which the step ends
+
+  // --- Group command acknowledgement (group_commands.cpp) ---
+  uint32_t groupCounter; // Counter of the last group command
+  int groupStatus;       // GroupCommandStatus
+  int32_t groupLateUs;   // How late it was carried out
+
+  // --- End-stop interrupt handoff ---
+  std::atomic<int> armedStopPin; // Sensor the ISR may stop on, -1 = none
+  volatile bool stopCut;         // ISR has cut the servo signal
+  volatile uint32_t stopEdgeUs;  // Time of the last arrival edge (low 32 bits)
+};
+extern CoverCalibratorDevice coverCalibrators[MAX_COVER_CALIBRATORS];
+extern int coverCalibratorCount; // Devices in use, 1..MAX_COVER_CALIBRATORS
+
+// --- COVER MOTION ---
+enum CoverMoveResult {
+  COVER_MOVE_STARTED,
+  COVER_MOVE_ALREADY_THERE,
+  COVER_MOVE_BLOCKED // Calibrator is on
+};
+extern const unsigned long coverMoveTimeoutMs;
+
+// CONTROL_SET_BRIGHTNESS result: no light while the cap is travelling.
+// Enforced in the control task, so every transport (Alpaca, UI, WebSocket,
+// group commands, MQTT) gets the same interlock.
+#define BRIGHTNESS_REFUSED (-1)
+
+// --- CONTROL TASK ---
+// Servo, EL panel and Hall sensors belong to the control task (core 1 on
+// dual-core chips). Everything network-facing runs in the network task (core
+// 0, next to the Wi-Fi stack) and asks for hardware changes by posting a
+// ControlCommand. Only the network task may post: the queue is single
+// producer / single consumer.
+#if CONFIG_FREERTOS_UNICORE || portNUM_PROCESSORS == 1
+#define NETWORK_TASK_CORE 0
+#define CONTROL_TASK_CORE 0
+#else
+#define NETWORK_TASK_CORE 0
+#define CONTROL_TASK_CORE 1
+#endif
+
+#define CONTROL_QUEUE_LENGTH 16     // Power of two
+#define CONTROL_TASK_PERIOD_MS 2    // Sensor poll interval between commands
+#define CONTROL_REPLY_TIMEOUT_MS 50 // How long a handler waits for a result
+
+enum ControlCommandType {
+  CONTROL_OPEN_COVER,     // result: CoverMoveResult
+  CONTROL_CLOSE_COVER,    // result: CoverMoveResult
+  CONTROL_HALT_COVER,     // result: 0
+  CONTROL_SET_BRIGHTNESS, // value: brightness, result: 0 or BRIGHTNESS_REFUSED
+  CONTROL_RESET_EL_AGING, // result: 0
+  CONTROL_START_SEQUENCE, // result: 0, or -1 if nothing was staged
+  CONTROL_ABORT_SEQUENCE, // result: 0
+  CONTROL_CAPTURE_LIGHT   // result: photodiode full-scale mV, or -1
+};
+
+struct ControlCommand {
+  ControlCommandType type;
+  uint8_t device; // Index into coverCalibrators[]
+  int value;
+  int rampMs;        // CONTROL_SET_BRIGHTNESS: -1 = the rampTimeMs setting
+  int dwellMs;       // CONTROL_SET_BRIGHTNESS: NotReady time after the ramp
+  int64_t atUs;      // esp_timer time to act at, 0 = at once
+  uint32_t groupCounter; // Group command counter, 0 = not a group command
+  uint32_t sequence; // Assigned by runControlCommand()
+};
+
+// How posting a command went (postControlCommand())
+enum ControlPostResult {
+  CONTROL_POST_APPLIED,    // Applied, result filled in
+  CONTROL_POST_QUEUE_FULL, // Never queued; nothing will happen
+  CONTROL_POST_TIMED_OUT   // Queued, and will be applied; no result yet
+};
+
+// Acknowledgement of the last group command, per device
+enum GroupCommandStatus {
+  GROUP_STATUS_NONE,
+  GROUP_STATUS_SCHEDULED, // Waiting for its execution time
+  GROUP_STATUS_DONE,
+  GROUP_STATUS_REFUSED // E.g. cover move while the panel is lit
+};
+
+// Lock-free ring for exactly one producer task and one consumer task. Each
+// index is only ever written by one side; the release/acquire pair publishes
+// the slot contents along with the index.
+template <typename T, size_t N> class SpscQueue {
+  static_assert((N & (N - 1)) == 0, "SpscQueue length must be a power of two");
+
+public:
+  bool push(const T &item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == N) {
+      return false; // Full
+    }
+    slots[h & (N - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+      return false; // Empty
+    }
+    item = slots[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  T slots[N];
+  std::atomic<size_t> head{0}; // Written by the producer only
+  std::atomic<size_t> tail{0}; // Written by the consumer only
+};
+
+// --- BRIGHTNESS PRESETS ---
+#define MAX_BRIGHTNESS_PRESETS 8
+#define PRESET_NAME_LENGTH 16      // Including the terminating NUL
+#define PRESET_MAX_DWELL_MS 60000
+
+struct BrightnessPreset {
+  char name[PRESET_NAME_LENGTH]; // Empty = unused slot
+  int32_t brightness;
+  int32_t rampMs;  // -1 = the rampTimeMs setting
+  int32_t dwellMs; // Calibrator stays NotReady this long after the ramp
+};
+extern BrightnessPreset brightnessPresets[MAX_BRIGHTNESS_PRESETS];
+
+// --- DEVICE STATE SNAPSHOT ---
+// Readers outside the control task (HTTP handlers, UI, discovery) never look
+// at the state fields of coverCalibrators[] directly. The control task
+// publishes each device as one consistent DeviceSnapshot through a seqlock,
+// and readers copy it out without locking or waiting on the writer.
+struct DeviceSnapshot {
+  uint32_t generation; // Bumped on every change; key caches/push off this
+  int coverState;
+  int calibratorState;
+  int brightness;
+  int servoAngle;
+  bool dimmerActive;
+  bool calibratorChanging; // Brightness ramp in progress
+  bool closedStopActive; // Closed Hall sensor sees the magnet
+  bool openStopActive;   // Open Hall sensor sees the magnet
+  bool moving;
+  bool coverFault;                // Last move stalled (CoverState Error)
+  unsigned long moveStartMs;      // millis() at the start of the move
+  uint32_t expectedMoveMs;        // Expected duration of the move
+  uint32_t learnedOpenMs;         // Learned travel times, 0 = unknown
+  uint32_t learnedCloseMs;
+  uint32_t elCentiHours; // Panel age, full-duty hours x100
+  bool lightLoopEnabled;  // Photodiode fitted and referenced
+  bool lightLoopLocked;   // Regulator has converged
+  int sequenceState;      // SequenceState
+  int sequenceStep;
+  int sequenceStepCount;
+  unsigned long sequenceDeadlineMs;
+  uint32_t groupCounter;
+  int groupStatus; // GroupCommandStatus
+  int32_t groupLateUs;
+};
+
+// Single-writer sequence lock. The payload lives in relaxed atomic words so a
+// reader racing the writer is well defined; it simply retries when the
+// sequence was odd (write in progress) or changed while it was copying.
+template <typename T> class Seqlock {
+  static constexpr size_t WORDS = (sizeof(T) + 3) / 4;
+
+public:
+  void write(const T &value) {
+    uint32_t raw[WORDS] = {};
+    memcpy(raw, &value, sizeof(T));
+    uint32_t s = sequence.load(std::memory_order_relaxed);
+    sequence.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < WORDS; i++) {
+      words[i].store(raw[i], std::memory_order_relaxed);
+    }
+    sequence.store(s + 2, std::memory_order_release);
+  }
+
+  void read(T &value) const {
+    uint32_t raw[WORDS];
+    uint32_t before, after;
+    do {
+      before = sequence.load(std::memory_order_acquire);
+      for (size_t i = 0; i < WORDS; i++) {
+        raw[i] = words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    memcpy(&value, raw, sizeof(T));
+  }
+
+private:
+  std::atomic<uint32_t> sequence{0};
+  std::atomic<uint32_t> words[WORDS] = {};
+};
+
+void publishDeviceSnapshot(int device); // Control task only
+void readDeviceSnapshot(int device, DeviceSnapshot &snapshot);
 
 // --- CONFIG STRUCT ---
 struct DeviceSettings {
@@ -77,18 +402,272 @@ struct DeviceSettings {
   String ip;
   String gateway;
   String subnet;
-  String title1;
-  String title2;
+  String title[MAX_COVER_CALIBRATORS]; // Saved as "title1", "title2", ...
+  int deviceCount;
+  int rampTimeMs; // Brightness ramp length, 0 = step
+  int servoSpeed; // Cap cruise speed, deg/s
+  int servoAccel; // Cap acceleration, deg/s^2
+  int servoDecel; // Cap deceleration, deg/s^2
+  int stallMarginPct; // A move this much over its learned time is a stall
+  int elHalfLifeHours; // EL output halves after this, 0 = no compensation
+  int photoFullScaleMv[MAX_COVER_CALIBRATORS]; // 0 = no light regulation
+  String groups[MAX_COVER_CALIBRATORS]; // Comma-separated group names
+  String groupKey; // Shared HMAC key for group commands, empty = off
+  String mqttHost;  // Broker host name or IP, empty = MQTT off
+  int mqttPort;
+  String mqttUser;     // Empty = connect without credentials
+  String mqttPassword; // Write-only, like groupKey
+  String mqttTopic;    // Topic base, empty = flatcat/<hostname>
   long gmtOffset;
   int daylightOffset;
 };
 extern DeviceSettings currentSettings;
 extern const char *ap_ssid;
 
+// --- ALPACA REQUEST PARAMETERS ---
+// Decoded Action 'Parameters' text; a full flat sequence has to fit
+#define ALPACA_ACTION_PARAMETERS_SIZE 768
+
+// A parameter value pointing into the request text (not NUL terminated)
+struct AlpacaParamValue {
+  const char *data;
+  size_t length;
+  bool urlEncoded; // Still percent-encoded (taken from raw query/body text)
+};
+
+// The Alpaca parameters we act on, collected in a single pass over the query
+// string and the form body. Names are matched case-insensitively as the
+// Alpaca specification requires.
+struct AlpacaParams {
+  bool hasClientID;
+  long clientID;
+  bool hasClientTransactionID;
+  bool clientTransactionIDValid; // Present, numeric and non-zero
+  long clientTransactionID;
+  bool hasBrightness;
+  bool brightnessValid; // Present and numeric
+  long brightness;
+  AlpacaParamValue action;     // data == nullptr when absent
+  AlpacaParamValue parameters; // data == nullptr when absent
+};
+
+void parseAlpacaParamString(const char *text, size_t length,
+                            AlpacaParams &params);
+void parseAlpacaServerArgs(AlpacaParams &params);
+size_t copyAlpacaParam(const AlpacaParamValue &value, char *out,
+                       size_t outSize, bool *truncated = nullptr);
+
+// --- HTTP REQUEST/RESPONSE ---
+// The request currently being handled. Both HTTP back ends implement this:
+// the stock WebServer (AP mode, or FLATCAT_EVENT_HTTP_SERVER 0) and the
+// multi-connection keep-alive HttpEventServer. Page, UI and Alpaca handlers
+// talk to 'http' and run unchanged on either one.
+class HttpContext {
+public:
+  virtual ~HttpContext() {}
+  virtual HTTPMethod method() const = 0;
+  virtual const char *path() const = 0; // Without the query string
+  virtual bool hasArg(const char *name) const = 0;
+  virtual String arg(const char *name) const = 0;
+  // Decodes a whole argument into 'out'; false if absent or it did not fit
+  virtual bool copyArg(const char *name, char *out, size_t size) const = 0;
+  virtual void collectAlpacaParams(AlpacaParams &params) const = 0;
+  virtual void sendHeader(const char *name, const char *value) = 0;
+  virtual void send(int code, const char *contentType, const char *body,
+                    size_t length) = 0;
+
+  void send(int code, const char *contentType, const char *body) {
+    send(code, contentType, body, strlen(body));
+  }
+  void send(int code, const char *contentType, const String &body) {
+    send(code, contentType, body.c_str(), body.length());
+  }
+
+  // Turns this request into a text/event-stream that stays open for the
+  // status pushes. Only the event server can; false means answer normally.
+  virtual bool beginEventStream() { return false; }
+  // Completes a WebSocket upgrade on this request (event server only)
+  virtual bool beginWebSocket() { return false; }
+};
+extern HttpContext *http;
+
+// HttpContext over the global WebServer, created per request
+class WebServerContext : public HttpContext {
+public:
+  WebServerContext();
+  HTTPMethod method() const override;
+  const char *path() const override;
+  bool hasArg(const char *name) const override;
+  String arg(const char *name) const override;
+  bool copyArg(const char *name, char *out, size_t size) const override;
+  void collectAlpacaParams(AlpacaParams &params) const override;
+  void sendHeader(const char *name, const char *value) override;
+  void send(int code, const char *contentType, const char *body,
+            size_t length) override;
+  using HttpContext::send;
+
+private:
+  String uri;
+};
+
+// A fixed route, registered with whichever back end is serving
+struct HttpRoute {
+  const char *path;
+  HTTPMethod method;
+  void (*handler)();
+};
+
+// Set to 0 to serve the main UI and Alpaca API from the stock WebServer
+#ifndef FLATCAT_EVENT_HTTP_SERVER
+#define FLATCAT_EVENT_HTTP_SERVER 1
+#endif
+
+#define HTTP_MAX_CONNECTIONS 8
+#define HTTP_REQUEST_BUFFER_SIZE 2048
+#define HTTP_KEEPALIVE_TIMEOUT_MS 15000
+
+// Server-Sent Events (/events): open streams hold a connection slot each,
+// so they are capped below HTTP_MAX_CONNECTIONS to leave room for the API
+#define HTTP_MAX_EVENT_STREAMS 3
+#define HTTP_EVENT_CHECK_MS 100       // How often the status is compared
+#define HTTP_EVENT_HEARTBEAT_MS 15000 // Comment line when nothing changed
+#define HTTP_EVENT_BUFFER_SIZE 512
+
+// WebSocket command channel (/ws): same cap as the event streams, and
+// slider values are applied at most this often per device (newest wins)
+#define HTTP_MAX_WEBSOCKETS 3
+#define WS_BRIGHTNESS_INTERVAL_MS 50
+
+// --- ALPACA RESPONSE WRITER ---
+// Serializes an Alpaca JSON response straight into a fixed buffer on the
+// caller's stack, so building and sending a response never touches the heap.
+// The constructor writes the mandatory header fields; add an optional Value
+// and then call send().
+#define ALPACA_RESPONSE_BUFFER_SIZE 1024
+
+class AlpacaResponse {
+public:
+  AlpacaResponse(long clientTransactionID, int errorNum = 0,
+                 const char *errorMsg = "");
+
+  // Template mode writes only what follows the two transaction IDs, for the
+  // pre-serialized response cache: "ErrorNumber":0,"ErrorMessage":"",...}
+  enum TemplateMode { TEMPLATE };
+  explicit AlpacaResponse(TemplateMode);
+
+  // "Value": <scalar>
+  void value(bool v);
+  void value(int v);
+  void value(long v);
+  void value(double v);
+  void value(const char *v);
+
+  // "Value": [ ... ] / "Value": { ... }
+  void beginValueArray();
+  void beginValueObject();
+
+  // Array elements and nested containers
+  void add(bool v);
+  void add(int v);
+  void add(long v);
+  void add(double v);
+  void add(const char *v);
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+
+  // Object members ("name": value)
+  void member(const char *name, bool v);
+  void member(const char *name, int v);
+  void member(const char *name, long v);
+  void member(const char *name, double v);
+  void member(const char *name, const char *v);
+
+  const char *c_str(); // Closes the document and returns the body
+  size_t length() const { return len; }
+  bool overflowed() const { return overflow; }
+  void send(int httpCode = 200);
+
+private:
+  void key(const char *name);
+  void separator();
+  void raw(const char *s);
+  void raw(const char *s, size_t n);
+  void rawChar(char c);
+  void quoted(const char *s);
+  void number(long v);
+  void number(double v);
+  void open(char c);
+  void close(char c);
+
+  char buf[ALPACA_RESPONSE_BUFFER_SIZE];
+  size_t len;
+  uint8_t depth;
+  uint8_t needComma; // Bit per nesting level: an element was already written
+  uint8_t isObject;  // Bit per nesting level: container is an object
+  bool overflow;
+  bool finished;
+};
+
+void sendAlpacaOK(long clientTransactionID);
+void sendAlpacaError(int httpCode, long clientTransactionID, int errorNum,
+                     const char *errorMsg);
+void sendAlpacaValue(long clientTransactionID, bool value);
+void sendAlpacaValue(long clientTransactionID, int value);
+void sendAlpacaValue(long clientTransactionID, const char *value);
+
+// --- ALPACA RESPONSE CACHE ---
+// Bodies that only differ in their transaction IDs are serialized once and
+// patched on the way out. Call invalidateAlpacaResponseCache() whenever
+// anything they are built from (currentSettings, deviceUniqueID) changes.
+enum AlpacaCachedResponse {
+  ALPACA_CACHED_CAPABILITY, // canopen / canclose / canhalt
+  ALPACA_CACHED_INTERFACE_VERSION,
+  ALPACA_CACHED_DESCRIPTION, // + device number, one per device
+  ALPACA_CACHED_DESCRIPTION_LAST =
+      ALPACA_CACHED_DESCRIPTION + MAX_COVER_CALIBRATORS - 1,
+  ALPACA_CACHED_DRIVER_INFO,
+  ALPACA_CACHED_DRIVER_VERSION,
+  ALPACA_CACHED_MAX_BRIGHTNESS,
+  ALPACA_CACHED_SUPPORTED_ACTIONS,
+  ALPACA_CACHED_API_VERSIONS,
+  ALPACA_CACHED_SERVER_DESCRIPTION,
+  ALPACA_CACHED_CONFIGURED_DEVICES,
+  ALPACA_CACHED_COUNT
+};
+
+void buildAlpacaResponseCache();
+void invalidateAlpacaResponseCache();
+void sendCachedAlpacaResponse(AlpacaCachedResponse which,
+                              long clientTransactionID);
+
+// --- ALPACA ROUTING ---
+// A request path split into lowercased segments, e.g.
+// /api/v1/covercalibrator/0/brightness -> api|v1|covercalibrator|0|brightness
+#define ALPACA_MAX_PATH_SEGMENTS 5
+#define ALPACA_SEGMENT_SIZE 24
+
+struct AlpacaPath {
+  char segment[ALPACA_MAX_PATH_SEGMENTS][ALPACA_SEGMENT_SIZE];
+  uint8_t count;
+};
+
+// Registered with server.addHandler(); takes every /api/v1/ and /management/
+// request and hands the split path to handleAlpacaAPI()
+class AlpacaRequestHandler : public RequestHandler {
+public:
+  bool canHandle(HTTPMethod method, const String &uri) override;
+  bool handle(WebServer &server, HTTPMethod requestMethod,
+              const String &requestUri) override;
+};
+
 // --- ALPACA DISCOVERY CONSTANTS ---
 extern const int ALPACA_DISCOVERY_PORT;
 extern const char *ALPACA_DISCOVERY_RESPONSE;
-extern String deviceUniqueID; // Declare the unique ID
+extern const IPAddress FLATCAT_GROUP_MULTICAST;
+extern const char *ALPACA_DISCOVERY_IPV6_GROUP;
+extern String deviceUniqueID; // Declare the unique ID (device 0)
 
 // ================================================================
 // --- FUNCTION PROTOTYPES (Used by all files) ---
@@ -97,35 +676,112 @@ extern String deviceUniqueID; // Declare the unique ID
 // --- Alpaca Core Functions (alpaca_api.cpp) ---
 void startAlpacaDiscovery();
 void handleAlpacaDiscovery();
-String createAlpacaJSON(long clientID, int errorNum, String errorMsg,
-                        const char *valueType, String value);
-void handleAlpacaAPI();
+void startAlpacaMdns();
+void updateAlpacaMdnsRecords();
+void handleAlpacaAPI(const AlpacaPath &path, HTTPMethod method);
+bool splitAlpacaPath(const char *uri, AlpacaPath &path);
 void handleAlpacaAPIVersions(long clientID);
+void dispatchAlpacaRequest(const char *uri, HTTPMethod method);
+bool isAlpacaPath(const char *uri);
+// --- HTTP Back Ends (http_server.cpp) ---
+void registerHttpRoutes(const HttpRoute *routes, size_t count);
+void startHttpEventServer();
+void handleHttpEventServer();
 // --- Custom Web Server/Hardware Functions (web_handlers.cpp) ---
 void handleRoot();
 void handleSettings();
 void handleGetTime();
-void handleSlider1();
-// void handleSlider2();
-void handleOpen1();
-void handleClose1();
-// void handleOpen2();
-// void handleClose2();
+void handleSlider(); // /sliderN, /openN, /closeN: N is the 1-based column
+void handleOpen();
+void handleClose();
 void handleGetAllStatus();
+void handleEventStream();
+void handleWebSocket();
+void handleWebSocketMessage(const char *text, size_t length);
+void runWebSocketCommands();
+void broadcastWebSocketText(const char *text, size_t length);
+size_t buildStatusEvent(char *out, size_t size);
 void handleGetSettings();
 void handleSave();
+void handleSequenceStart();
+void handleSequenceAbort();
+void handleSequenceStatus();
+void handleGetPresets();
+void handleSavePresets();
 void handleScan();
 void handleSaveWifi();
 void handleNotFound();
-void handleTestMove(); // <-- NEW DEBUG FUNCTION
-void updateDimmerLock();
 void startApMode();
 void loadSettings();
 void startMainServer();
-void updateCoverStatus();
-void checkAndStopServo();
-int validateDeviceNumber(String uri);
 void initializeUniqueID();
-bool isNumeric(String str);
-void setDimmerValue(int brightness);
+void formatDeviceUniqueID(int device, char *out, size_t size);
+bool isNumeric(const char *str);
+
+// --- EL Panel Dimmer (el_dimmer.cpp) ---
+void setDimmerValue(CoverCalibratorDevice &dev, int brightness, int rampMs,
+                    int dwellMs);
+void updateCalibratorStatus(CoverCalibratorDevice &dev);
+void refreshElOutput(CoverCalibratorDevice &dev);
+void initLightLoops();
+bool isLightLoopEnabled(const CoverCalibratorDevice &dev);
+bool isCalibratorChanging(const CoverCalibratorDevice &dev);
+int captureLightReference(CoverCalibratorDevice &dev);
+
+// --- EL Panel Aging (el_aging.cpp) ---
+void loadElAging();
+void accountElOnTime(CoverCalibratorDevice &dev);
+void resetElAging(CoverCalibratorDevice &dev);
+float elOnHours(const CoverCalibratorDevice &dev);
+float elAgingFactor(const CoverCalibratorDevice &dev);
+
+// --- Cover Motion Engine (cover_motion.cpp) ---
+void initCoverCalibrators();
+CoverMoveResult startCoverMove(CoverCalibratorDevice &dev, bool open);
+void haltCover(CoverCalibratorDevice &dev);
+bool isCoverMoving(const CoverCalibratorDevice &dev);
+void updateCoverStatus(CoverCalibratorDevice &dev);
+void checkAndStopServo(CoverCalibratorDevice &dev);
+
+// --- Cap Travel-Time Model (travel_model.cpp) ---
+void loadTravelModels();
+void recordTravelTime(CoverCalibratorDevice &dev, bool open, uint32_t ms);
+
+// --- Brightness Presets (presets.cpp) ---
+void loadBrightnessPresets();
+void saveBrightnessPresets();
+bool isValidPresetName(const char *name);
+int findBrightnessPreset(const char *name);
+bool setBrightnessPreset(const char *name, int brightness, int rampMs,
+                         int dwellMs);
+bool deleteBrightnessPreset(const char *name);
+bool recallBrightnessPreset(int device, int index, int *result);
+
+// --- Flat Sequence Engine (sequence.cpp) ---
+void initSequenceEngine();
+SequenceUploadResult uploadSequence(int device, const char *text);
+int startStagedSequence(CoverCalibratorDevice &dev);
+void abortSequence(CoverCalibratorDevice &dev);
+bool isSequenceRunning(const CoverCalibratorDevice &dev);
+void runSequence(CoverCalibratorDevice &dev);
+const char *sequenceStateName(int state);
+void formatSequenceStatus(int device, char *out, size_t size);
+
+// --- Group Commands (group_commands.cpp) ---
+bool handleGroupPacket(char *packet, size_t length);
+void resetGroupCounter();
+const char *groupStatusName(int status);
+
+// --- MQTT State and Commands (mqtt_client.cpp) ---
+void startMqtt();
+void handleMqtt();
+
+// --- Network / Control Tasks (tasks.cpp) ---
+void startTasks();
+ControlPostResult postControlCommand(ControlCommand cmd, int *result);
+bool runControlCommand(ControlCommand cmd, int *result);
+bool runControlCommand(int device, ControlCommandType type, int value,
+                       int *result);
+void notifyControlTask();
+void notifyControlTaskFromISR();
 #endif // FLATCAT_H
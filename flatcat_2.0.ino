@@ -5,21 +5,36 @@
 // ================================================================
 // --- GLOBAL OBJECT DEFINITIONS ---
 // ================================================================
-WebServer server(80);
-Servo myServo_1;
-// Servo myServo_2;
+FlatcatWebServer server(80);
 Preferences preferences;
 DNSServer dnsServer;
-WiFiUDP udp;
 
 // --- HARDWARE PINS ---
-int elPin_1 = D8;
-// int elPin_2 = D6;
-int servoPin_1 = D9;
-// int servoPin_2 = D7;
 int factoryResetPin = D0;
-int closedStopPin_1 = D1; // <-- DEFINITION for Closed Sensor
-int openStopPin_1 = D2;   // <-- DEFINITION for Open Sensor
+
+// --- COVER CALIBRATOR DEVICES ---
+// {EL panel, servo, closed sensor, open sensor, EL LEDC channel,
+// photodiode ADC}. Set a sensor to -1 if it is not fitted; the move then
+// ends on the travel timeout. The photodiode is only used once a reference
+// has been captured (Alpaca Action "CaptureLightReference").
+// The EL channels sit above the ones ESP32Servo takes for the 50 Hz servo
+// timer and share one LEDC timer between them.
+// The photodiodes need ADC inputs. D5/D10 are ADC1 pins on the XIAO ESP32S3
+// only (GPIO6/GPIO9); on the C3 and C6 they are plain GPIOs and every spare
+// ADC pin is already taken, so there the loop is left out. A pin without an
+// ADC channel is also dropped at start-up (see initLightLoops()).
+#if CONFIG_IDF_TARGET_ESP32S3
+#define PHOTO_PIN_0 D5
+#define PHOTO_PIN_1 D10
+#else
+#define PHOTO_PIN_0 -1
+#define PHOTO_PIN_1 -1
+#endif
+CoverCalibratorDevice coverCalibrators[MAX_COVER_CALIBRATORS] = {
+    {D8, D9, D1, D2, 4, PHOTO_PIN_0}, // Device 0 (column 1)
+    {D6, D7, D3, D4, 5, PHOTO_PIN_1}, // Device 1 (column 2)
+};
+int coverCalibratorCount = 1; // Overwritten from the settings
 
 // --- SERVO CONFIG / CONSTANTS ---
 int openAngle = 90;
@@ -30,24 +45,16 @@ const int coverReady =
 const int coverClosed = 1; // ASCOM standard for Closed
 const int coverMoving = 2; // ASCOM standard for Moving
 const int coverOpen = 3;   // ASCOM standard for Open
+const int coverError = 5;  // ASCOM standard for Error (stalled move)
 
-const int calibratorReady = 0;
-const int calibratorNotReady = 1;
-const int maxBrightness = 64;
+// ASCOM CalibratorStatus values
+const int calibratorOff = 1;
+const int calibratorNotReady = 2; // Brightness still ramping
+const int calibratorReady = 3;
+const int maxBrightness = EL_MAX_BRIGHTNESS;
 
 // --- STATE VARIABLES ---
 long serverTransactionID = 1;
-int currentServoAngle_1 = closeAngle;
-// int currentServoAngle_2 = closeAngle;
-int coverState_1 = coverClosed;
-int currentDimmerValue_1 = 0;
-// int currentDimmerValue_2 = 0;
-bool isDimmerActive = false;
-int calibratorState_1 = calibratorNotReady;
-bool isClosedStopActive_1 = false; // <-- DEFINITION: Initial state
-bool isOpenStopActive_1 = false;   // <-- DEFINITION: Initial state
-bool isMovingToClose_1 = false;    // <-- DEFINITION
-bool isMovingToOpen_1 = false;     // <-- DEFINITION
 
 // --- CONFIG & TIME ---
 DeviceSettings currentSettings;
@@ -60,6 +67,9 @@ String deviceUniqueID = "FLATCAT";
 // --- ALPACA DISCOVERY CONSTANTS ---
 const int ALPACA_DISCOVERY_PORT = 32227;
 const char *ALPACA_DISCOVERY_RESPONSE = "{\"AlpacaPort\": 80}";
+const char *ALPACA_DISCOVERY_IPV6_GROUP = "ff12::a1:9aca"; // Alpaca standard
+// Group commands (group_commands.cpp) also arrive on the discovery port
+const IPAddress FLATCAT_GROUP_MULTICAST(239, 255, 32, 227);
 
 // ================================================================
 // --- C++ SETUP ---
@@ -106,27 +116,14 @@ void setup() {
   // initializeUniqueID(); // Initialize the persistent ASCOM ID
 
   // --- 3. Initialize Hardware and Sensors ---
-  pinMode(elPin_1, OUTPUT);
-  //  pinMode(elPin_2, OUTPUT);
-  analogWrite(elPin_1, 0);
-  //  analogWrite(elPin_2, 0);
-
   // PWM and Servo setup
   // ESP32PWM::allocateTimer(0); // Often used by WiFi/System
   ESP32PWM::allocateTimer(1); // Try Timer 1 only
   // ESP32PWM::allocateTimer(2);
   // ESP32PWM::allocateTimer(3);
-  myServo_1.attach(servoPin_1);
-  // myServo_2.attach(servoPin_2);
-
-  // Initial servo positions and sensor pin setup
-  myServo_1.write(currentServoAngle_1);
-  // myServo_2.write(currentServoAngle_2);
-  myServo_1.detach(); // Stop sending signals
-  // Initialize Sensor Pins with Internal Pull-Up (A3213 requirement)
 
-  pinMode(closedStopPin_1, INPUT_PULLUP);
-  pinMode(openStopPin_1, INPUT_PULLUP);
+  // EL panels off, caps parked closed, Hall sensor pull-ups on
+  initCoverCalibrators();
   // TIMSK0=0;
   // --- 4. Load Credentials and Connect WiFi ---
   // Read the saved credentials (read-only)
@@ -139,6 +136,7 @@ void setup() {
     startApMode();
   } else {
     Serial.println("Found credentials for: " + saved_ssid);
+    WiFi.enableIPv6(); // Link-local address for IPv6 Alpaca discovery
     WiFi.begin(saved_ssid.c_str(), saved_pass.c_str());
 
     unsigned long startTime = millis();
@@ -159,38 +157,16 @@ void setup() {
       startApMode();
     }
   }
+
+  // --- 5. Hand over to the network (core 0) and control (core 1) tasks ---
+  startTasks();
 }
 
 // ================================================================
 // --- C++ LOOP ---
 // ================================================================
 void loop() {
-  // 1. Process standard web clients (CRITICAL for TCP connections)
-  server.handleClient();
-
-  // 2. Process background discovery (Non-blocking UDP)
-  handleAlpacaDiscovery();
-
-  // If in AP mode, process DNS requests
-  if (WiFi.status() != WL_CONNECTED) {
-    dnsServer.processNextRequest();
-  }
-
-  // 3. NEW: Check and update the physical cover status
-  updateCoverStatus(); // <-- NEW CALL
-  checkAndStopServo();
-  // --- NON-BLOCKING TIME UPDATE ---
-  if (millis() - lastTimeUpdate > 1000) {
-    lastTimeUpdate = millis();
-
-    struct tm timeinfo;
-    if (!getLocalTime(&timeinfo) || timeinfo.tm_year < 100) {
-      currentTimeString = "Syncing...";
-    } else {
-      char timeString[20];
-      strftime(timeString, sizeof(timeString), "%I:%M:%S %p", &timeinfo);
-      currentTimeString = timeString;
-    }
-  }
-  delay(1);
+  // All work happens in the network and control tasks started by setup(); the
+  // Arduino loop task has nothing left to do.
+  vTaskDelete(NULL);
 }
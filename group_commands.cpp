@@ -0,0 +1,208 @@
+// group_commands.cpp
+
+#include "flatcat.h"
+#include "mbedtls/md.h"
+#include <sys/time.h>
+
+// ================================================================
+// --- GROUP COMMANDS ---
+// ================================================================
+// One UDP packet opens, closes or lights every flatcat in a named group at
+// the same moment. Packets arrive on the Alpaca discovery socket (port
+// 32227, which also joins FLATCAT_GROUP_MULTICAST) and look like:
+//
+//   flatcatgroup1|<group>|<counter>|<epochMs>|<command>|<value>|<hmac>
+//
+//   group    Group name; a device acts if it is listed in its groups setting
+//   counter  Sender's message counter, must increase (replay protection,
+//            kept across reboots, restarted when the group key changes)
+//   epochMs  UTC time to act at, in ms since 1970 (NTP clock)
+//   command  open, close, halt or brightness (value = 0..maxBrightness)
+//   hmac     Lowercase hex HMAC-SHA256 of everything before the last '|',
+//            keyed with the shared group key setting
+//
+// The execution time is turned into an esp_timer deadline and handed to the
+// control task, which acts on it from a one-shot timer, so members whose
+// clocks are NTP-synced act within milliseconds of each other no matter how
+// the packet was delayed. Each device acknowledges through its normal
+// status (/getallstatus "group", devicestate GroupCounter/GroupStatus).
+// Network task only.
+
+#define GROUP_PACKET_PREFIX "flatcatgroup1|"
+#define GROUP_HMAC_HEX_LENGTH 64
+#define GROUP_MAX_LEAD_MS 60000 // Refuse execution times further out
+#define GROUP_MAX_LATE_MS 2000  // Acts at once if this late, else refuses
+
+// Highest counter accepted so far. Kept in NVS, so a packet captured before
+// a reboot cannot be replayed inside its time window after it.
+static uint32_t lastGroupCounter = 0;
+static bool groupCounterLoaded = false;
+static Preferences groupPrefs; // Own handle, like the other NVS stores
+
+static uint32_t loadGroupCounter() {
+  if (!groupCounterLoaded) {
+    groupPrefs.begin("flatcat-group", true);
+    lastGroupCounter = groupPrefs.getULong("counter", 0);
+    groupPrefs.end();
+    groupCounterLoaded = true;
+  }
+  return lastGroupCounter;
+}
+
+static void storeGroupCounter(uint32_t counter) {
+  lastGroupCounter = counter;
+  groupPrefs.begin("flatcat-group", false);
+  groupPrefs.putULong("counter", counter);
+  groupPrefs.end();
+}
+
+/**
+ * @brief Forgets the counter high-water mark; a new group key starts a new
+ * counter sequence. Called when the key is changed or cleared.
+ */
+void resetGroupCounter() {
+  groupPrefs.begin("flatcat-group", false);
+  groupPrefs.remove("counter");
+  groupPrefs.end();
+  lastGroupCounter = 0;
+  groupCounterLoaded = true;
+}
+
+static bool deviceInGroup(int device, const char *group, size_t length) {
+  const String &groups = currentSettings.groups[device];
+  int start = 0;
+  while (start <= (int)groups.length()) {
+    int end = groups.indexOf(',', start);
+    if (end < 0)
+      end = groups.length();
+    String name = groups.substring(start, end);
+    name.trim();
+    if (name.length() == length &&
+        strncasecmp(name.c_str(), group, length) == 0) {
+      return true;
+    }
+    start = end + 1;
+  }
+  return false;
+}
+
+// Compares the packet's hex HMAC with our own in constant time
+static bool groupHmacValid(const char *signedPart, size_t length,
+                           const char *hex) {
+  const String &key = currentSettings.groupKey;
+  unsigned char mac[32];
+  if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                      (const unsigned char *)key.c_str(), key.length(),
+                      (const unsigned char *)signedPart, length, mac) != 0) {
+    return false;
+  }
+  static const char digits[] = "0123456789abcdef";
+  uint8_t diff = 0;
+  for (int i = 0; i < 32; i++) {
+    diff |= hex[i * 2] ^ digits[mac[i] >> 4];
+    diff |= hex[i * 2 + 1] ^ digits[mac[i] & 0x0F];
+  }
+  return diff == 0;
+}
+
+// Splits "a|b|c" in place; returns the number of fields found
+static int splitGroupFields(char *text, char **fields, int maxFields) {
+  int count = 0;
+  fields[count++] = text;
+  for (char *p = text; *p && count < maxFields; p++) {
+    if (*p == '|') {
+      *p = '\0';
+      fields[count++] = p + 1;
+    }
+  }
+  return count;
+}
+
+static bool parseGroupCommand(const char *name, ControlCommandType &type) {
+  if (strcmp(name, "open") == 0) {
+    type = CONTROL_OPEN_COVER;
+  } else if (strcmp(name, "close") == 0) {
+    type = CONTROL_CLOSE_COVER;
+  } else if (strcmp(name, "halt") == 0) {
+    type = CONTROL_HALT_COVER;
+  } else if (strcmp(name, "brightness") == 0) {
+    type = CONTROL_SET_BRIGHTNESS;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Handles a datagram if it is a group command.
+ * @return false if it is not one (so the caller can try discovery).
+ */
+bool handleGroupPacket(char *packet, size_t length) {
+  size_t prefixLength = strlen(GROUP_PACKET_PREFIX);
+  if (length < prefixLength ||
+      strncmp(packet, GROUP_PACKET_PREFIX, prefixLength) != 0) {
+    return false;
+  }
+  if (currentSettings.groupKey.length() == 0) {
+    return true; // Group commands are off without a key
+  }
+
+  // 1. Authenticate before looking at anything else
+  char *lastBar = strrchr(packet, '|');
+  if (lastBar == nullptr || strlen(lastBar + 1) != GROUP_HMAC_HEX_LENGTH ||
+      !groupHmacValid(packet, lastBar - packet, lastBar + 1)) {
+    return true; // Bad signature
+  }
+
+  // 2. flatcatgroup1|group|counter|epochMs|command|value|hmac
+  char *fields[7];
+  if (splitGroupFields(packet, fields, 7) != 7) {
+    return true;
+  }
+  uint32_t counter = strtoul(fields[2], nullptr, 10);
+  int64_t epochMs = strtoll(fields[3], nullptr, 10);
+  ControlCommandType type;
+  if (!parseGroupCommand(fields[4], type) || counter <= loadGroupCounter()) {
+    return true; // Unknown command, or a replay
+  }
+
+  // 3. Turn the NTP time into an esp_timer deadline
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  if (now.tv_sec < 1600000000) {
+    return true; // Clock not synced yet
+  }
+  int64_t nowMs = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+  int64_t leadMs = epochMs - nowMs;
+  if (leadMs > GROUP_MAX_LEAD_MS || leadMs < -GROUP_MAX_LATE_MS) {
+    return true; // Stale, or too far out to be a sane schedule
+  }
+  if (epochMs < nowMs - (int64_t)millis()) {
+    return true; // Scheduled before we booted: cannot be meant for us
+  }
+  storeGroupCounter(counter);
+
+  // 4. Hand it to every member device
+  ControlCommand cmd = {type, 0, atoi(fields[5]), -1, 0, 0, 0, 0};
+  cmd.atUs = esp_timer_get_time() + max(leadMs, (int64_t)0) * 1000;
+  cmd.groupCounter = counter;
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    if (deviceInGroup(i, fields[1], strlen(fields[1]))) {
+      cmd.device = i;
+      runControlCommand(cmd, nullptr);
+    }
+  }
+  return true;
+}
+
+const char *groupStatusName(int status) {
+  switch (status) {
+  case GROUP_STATUS_SCHEDULED:
+    return "scheduled";
+  case GROUP_STATUS_DONE:
+    return "done";
+  case GROUP_STATUS_REFUSED:
+    return "refused";
+  }
+  return "none";
+}
@@ -0,0 +1,881 @@
+// http_server.cpp
+
+#include "flatcat.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/sha1.h"
+
+// The request being handled right now (set by whichever back end dispatched)
+HttpContext *http = nullptr;
+
+static const HttpRoute *activeRoutes = nullptr;
+static size_t activeRouteCount = 0;
+
+static bool isFormBody(const char *contentType) {
+  return contentType[0] == '\0' ||
+         strncasecmp(contentType, "application/x-www-form-urlencoded", 33) ==
+             0;
+}
+
+// ================================================================
+// --- WEBSERVER BACK END ---
+// ================================================================
+
+WebServerContext::WebServerContext() : uri(server.uri()) {}
+
+HTTPMethod WebServerContext::method() const { return server.method(); }
+
+const char *WebServerContext::path() const { return uri.c_str(); }
+
+bool WebServerContext::hasArg(const char *name) const {
+  return server.hasArg(name);
+}
+
+String WebServerContext::arg(const char *name) const {
+  return server.arg(name);
+}
+
+bool WebServerContext::copyArg(const char *name, char *out,
+                               size_t size) const {
+  if (!server.hasArg(name) || size == 0) {
+    return false;
+  }
+  String value = server.arg(name); // Already decoded by WebServer
+  if (value.length() >= size) {
+    return false;
+  }
+  memcpy(out, value.c_str(), value.length() + 1);
+  return true;
+}
+
+void WebServerContext::collectAlpacaParams(AlpacaParams &params) const {
+  parseAlpacaServerArgs(params);
+}
+
+void WebServerContext::sendHeader(const char *name, const char *value) {
+  server.sendHeader(name, value);
+}
+
+void WebServerContext::send(int code, const char *contentType,
+                            const char *body, size_t length) {
+  server.send_P(code, contentType, body, length);
+}
+
+static void runOnWebServer(void (*handler)()) {
+  WebServerContext context;
+  http = &context;
+  handler();
+  http = nullptr;
+}
+
+// Registers the routes with both back ends; only the one that was started
+// will ever see traffic
+void registerHttpRoutes(const HttpRoute *routes, size_t count) {
+  activeRoutes = routes;
+  activeRouteCount = count;
+
+  for (size_t i = 0; i < count; i++) {
+    void (*handler)() = routes[i].handler;
+    server.on(routes[i].path, routes[i].method,
+              [handler]() { runOnWebServer(handler); });
+  }
+
+  // --- Alpaca API (/api/v1/..., /management/...) ---
+  server.addHandler(new AlpacaRequestHandler());
+
+  server.onNotFound([]() { runOnWebServer(handleNotFound); });
+}
+
+// ================================================================
+// --- EVENT-DRIVEN HTTP/1.1 BACK END ---
+// ================================================================
+// A non-blocking, multi-connection server polled by the network task. Each
+// slot keeps its own receive buffer, so a slow or idle client never holds up
+// the others, and connections stay open between requests (HTTP/1.1
+// keep-alive) so pollers do not pay a TCP handshake per request.
+
+static WiFiServer httpListener(80, HTTP_MAX_CONNECTIONS);
+static bool httpListenerRunning = false;
+
+class HttpConnection : public HttpContext {
+public:
+  HttpConnection()
+      : active(false), streaming(false), websocket(false), len(0),
+        extraHeadersLength(0) {}
+
+  void open(WiFiClient &newClient);
+  void close();
+  void poll();
+  void sendEvent(const char *text, size_t length);
+  void sendFrame(uint8_t opcode, const char *data, size_t length);
+  bool isActive() const { return active; }
+  bool isStreaming() const { return active && streaming; }
+  bool isWebSocket() const { return active && websocket; }
+  bool isIdle() const { return len == 0 && !streaming && !websocket; }
+  unsigned long idleSince() const { return lastActivityMs; }
+
+  // --- HttpContext ---
+  HTTPMethod method() const override { return reqMethod; }
+  const char *path() const override { return reqPath; }
+  bool hasArg(const char *name) const override;
+  String arg(const char *name) const override;
+  bool copyArg(const char *name, char *out, size_t size) const override;
+  void collectAlpacaParams(AlpacaParams &params) const override;
+  void sendHeader(const char *name, const char *value) override;
+  void send(int code, const char *type, const char *content,
+            size_t length) override;
+  using HttpContext::send;
+  bool beginEventStream() override;
+  bool beginWebSocket() override;
+
+private:
+  void processWebSocketFrames();
+  bool parseRequest(size_t headerLength);
+  void dispatch();
+  bool findArg(const char *text, size_t textLength, const char *name,
+               AlpacaParamValue &value) const;
+  bool findArg(const char *name, AlpacaParamValue &value) const;
+  void sendError(int code, const char *message);
+
+  WiFiClient client;
+  bool active;
+  bool streaming; // Answered /events; only pushes from here on
+  bool websocket; // Upgraded on /ws; buf holds frames from here on
+  unsigned long lastActivityMs;
+  char buf[HTTP_REQUEST_BUFFER_SIZE + 1]; // +1 keeps it NUL terminated
+  size_t len;
+
+  // --- The request being dispatched (points into buf) ---
+  HTTPMethod reqMethod;
+  const char *reqPath;
+  const char *query;
+  size_t queryLength;
+  const char *body;
+  size_t bodyLength;
+  char contentType[48];
+  char webSocketKey[32]; // Sec-WebSocket-Key, empty if not an upgrade
+  bool keepAlive;
+  bool responded;
+
+  char extraHeaders[160];
+  size_t extraHeadersLength;
+};
+
+static HttpConnection httpConnections[HTTP_MAX_CONNECTIONS];
+
+void HttpConnection::open(WiFiClient &newClient) {
+  client = newClient;
+  client.setNoDelay(true);
+  active = true;
+  streaming = false;
+  websocket = false;
+  len = 0;
+  lastActivityMs = millis();
+}
+
+void HttpConnection::close() {
+  client.stop();
+  active = false;
+  streaming = false;
+  websocket = false;
+  len = 0;
+}
+
+void HttpConnection::poll() {
+  if (!client.connected() && client.available() == 0) {
+    close();
+    return;
+  }
+  if (streaming) {
+    // The browser sends nothing more on an event stream; drop anything
+    // that arrives and leave the slot open, however long it is quiet
+    while (client.available() > 0) {
+      client.read();
+    }
+    return;
+  }
+
+  int available = client.available();
+  if (available > 0) {
+    size_t room = HTTP_REQUEST_BUFFER_SIZE - len;
+    if (room == 0) {
+      if (!websocket) {
+        sendError(413, "Request too large.");
+      }
+      close();
+      return;
+    }
+    int n = client.read((uint8_t *)buf + len,
+                        (size_t)available < room ? available : room);
+    if (n > 0) {
+      len += n;
+      buf[len] = '\0';
+      lastActivityMs = millis();
+    }
+  } else if (!websocket &&
+             millis() - lastActivityMs > HTTP_KEEPALIVE_TIMEOUT_MS) {
+    close(); // Idle keep-alive connection
+    return;
+  }
+
+  // Serve every complete request in the buffer (pipelined requests included)
+  while (active && !websocket && len > 0) {
+    char *headerEnd = strstr(buf, "\r\n\r\n");
+    if (headerEnd == nullptr) {
+      if (len == HTTP_REQUEST_BUFFER_SIZE) {
+        sendError(431, "Request headers too large.");
+        close();
+      }
+      return;
+    }
+    size_t headerLength = headerEnd - buf + 4;
+    if (!parseRequest(headerLength)) {
+      return; // Body still arriving, or the connection was closed
+    }
+    size_t requestLength = (body - buf) + bodyLength;
+
+    dispatch();
+
+    // Drop this request from the buffer and keep anything after it
+    memmove(buf, buf + requestLength, len - requestLength);
+    len -= requestLength;
+    buf[len] = '\0';
+
+    if (!keepAlive) {
+      close();
+    }
+  }
+
+  if (active && websocket) {
+    processWebSocketFrames();
+  }
+}
+
+static HTTPMethod parseHttpMethod(const char *m, size_t n) {
+  if (n == 3 && strncmp(m, "GET", 3) == 0)
+    return HTTP_GET;
+  if (n == 3 && strncmp(m, "PUT", 3) == 0)
+    return HTTP_PUT;
+  if (n == 4 && strncmp(m, "POST", 4) == 0)
+    return HTTP_POST;
+  if (n == 4 && strncmp(m, "HEAD", 4) == 0)
+    return HTTP_HEAD;
+  if (n == 6 && strncmp(m, "DELETE", 6) == 0)
+    return HTTP_DELETE;
+  if (n == 5 && strncmp(m, "PATCH", 5) == 0)
+    return HTTP_PATCH;
+  if (n == 7 && strncmp(m, "OPTIONS", 7) == 0)
+    return HTTP_OPTIONS;
+  return HTTP_ANY; // Unknown; no route matches it
+}
+
+// Content-Length value: digits only (trailing blanks allowed). Anything
+// past the buffer size saturates, so the caller's bounds check never
+// needs an addition that could wrap. Returns false if not a number.
+static bool parseContentLength(const char *value, size_t valueLength,
+                               size_t &length) {
+  size_t digits = 0;
+  length = 0;
+  while (digits < valueLength && isDigit(value[digits])) {
+    if (length <= HTTP_REQUEST_BUFFER_SIZE) {
+      length = length * 10 + (value[digits] - '0');
+    }
+    digits++;
+  }
+  for (size_t i = digits; i < valueLength; i++) {
+    if (value[i] != ' ' && value[i] != '\t') {
+      return false;
+    }
+  }
+  return digits > 0;
+}
+
+// Parses the request line and headers in place. Returns false if the body
+// is not complete yet (or the request was rejected and the slot closed).
+bool HttpConnection::parseRequest(size_t headerLength) {
+  // --- Request line: METHOD SP target SP HTTP/1.x ---
+  char *lineEnd = strstr(buf, "\r\n");
+  char *sp1 = (char *)memchr(buf, ' ', lineEnd - buf);
+  char *sp2 = sp1 ? (char *)memchr(sp1 + 1, ' ', lineEnd - sp1 - 1) : nullptr;
+  if (sp1 == nullptr || sp2 == nullptr) {
+    sendError(400, "Malformed request line.");
+    close();
+    return false;
+  }
+  bool http11 = strncmp(sp2 + 1, "HTTP/1.1", 8) == 0;
+
+  // --- Headers we care about ---
+  size_t contentLength = 0;
+  bool contentLengthValid = true;
+  keepAlive = http11;
+  contentType[0] = '\0';
+  webSocketKey[0] = '\0';
+  for (char *line = lineEnd + 2; line < buf + headerLength - 2;) {
+    char *next = strstr(line, "\r\n");
+    char *colon = (char *)memchr(line, ':', next - line);
+    if (colon != nullptr) {
+      const char *value = colon + 1;
+      while (*value == ' ')
+        value++;
+      size_t nameLength = colon - line;
+      size_t valueLength = next - value;
+      if (nameLength == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+        contentLengthValid =
+            parseContentLength(value, valueLength, contentLength);
+      } else if (nameLength == 10 &&
+                 strncasecmp(line, "Connection", 10) == 0) {
+        if (valueLength >= 5 && strncasecmp(value, "close", 5) == 0)
+          keepAlive = false;
+        else if (valueLength >= 10 && strncasecmp(value, "keep-alive", 10) == 0)
+          keepAlive = true;
+      } else if (nameLength == 12 &&
+                 strncasecmp(line, "Content-Type", 12) == 0) {
+        size_t n = valueLength < sizeof(contentType) - 1
+                       ? valueLength
+                       : sizeof(contentType) - 1;
+        memcpy(contentType, value, n);
+        contentType[n] = '\0';
+      } else if (nameLength == 17 &&
+                 strncasecmp(line, "Sec-WebSocket-Key", 17) == 0 &&
+                 valueLength < sizeof(webSocketKey)) {
+        memcpy(webSocketKey, value, valueLength);
+        webSocketKey[valueLength] = '\0';
+      }
+    }
+    line = next + 2;
+  }
+
+  if (!contentLengthValid) {
+    sendError(400, "Malformed Content-Length.");
+    close();
+    return false;
+  }
+  // headerLength <= HTTP_REQUEST_BUFFER_SIZE here (the headers are in buf)
+  if (contentLength > HTTP_REQUEST_BUFFER_SIZE - headerLength) {
+    sendError(413, "Request too large.");
+    close();
+    return false;
+  }
+  if (len < headerLength + contentLength) {
+    return false; // Wait for the rest of the body
+  }
+
+  // --- Commit: split the target into path and query in place ---
+  reqMethod = parseHttpMethod(buf, sp1 - buf);
+  char *target = sp1 + 1;
+  char *q = (char *)memchr(target, '?', sp2 - target);
+  *sp2 = '\0';
+  if (q != nullptr) {
+    *q = '\0';
+    query = q + 1;
+    queryLength = sp2 - query;
+  } else {
+    query = sp2;
+    queryLength = 0;
+  }
+  reqPath = target;
+  body = buf + headerLength;
+  bodyLength = contentLength;
+  return true;
+}
+
+void HttpConnection::dispatch() {
+  responded = false;
+  extraHeadersLength = 0;
+  http = this;
+
+  // HEAD is answered like GET (send() drops the body)
+  HTTPMethod routeMethod = (reqMethod == HTTP_HEAD) ? HTTP_GET : reqMethod;
+  bool routed = false;
+  for (size_t i = 0; i < activeRouteCount && !routed; i++) {
+    const HttpRoute &route = activeRoutes[i];
+    if (strcmp(route.path, reqPath) == 0 &&
+        (route.method == HTTP_ANY || route.method == routeMethod)) {
+      route.handler();
+      routed = true;
+    }
+  }
+  if (!routed) {
+    if (isAlpacaPath(reqPath)) {
+      dispatchAlpacaRequest(reqPath, reqMethod);
+    } else {
+      handleNotFound();
+    }
+  }
+
+  http = nullptr;
+  if (!responded) {
+    sendError(500, "Handler sent no response.");
+  }
+}
+
+bool HttpConnection::findArg(const char *text, size_t textLength,
+                             const char *name, AlpacaParamValue &value) const {
+  size_t nameLength = strlen(name);
+  const char *end = text + textLength;
+  while (text < end) {
+    const char *pairEnd = (const char *)memchr(text, '&', end - text);
+    if (pairEnd == nullptr)
+      pairEnd = end;
+    const char *eq = (const char *)memchr(text, '=', pairEnd - text);
+    const char *nameEnd = eq ? eq : pairEnd;
+    if ((size_t)(nameEnd - text) == nameLength &&
+        strncmp(text, name, nameLength) == 0) {
+      value.data = eq ? eq + 1 : pairEnd;
+      value.length = pairEnd - value.data;
+      value.urlEncoded = true;
+      return true;
+    }
+    text = pairEnd + 1;
+  }
+  return false;
+}
+
+// Looks in the query string first, then a form-encoded body (like WebServer)
+bool HttpConnection::findArg(const char *name, AlpacaParamValue &value) const {
+  return findArg(query, queryLength, name, value) ||
+         (isFormBody(contentType) && findArg(body, bodyLength, name, value));
+}
+
+bool HttpConnection::hasArg(const char *name) const {
+  AlpacaParamValue value;
+  return findArg(name, value);
+}
+
+String HttpConnection::arg(const char *name) const {
+  AlpacaParamValue value;
+  if (!findArg(name, value)) {
+    return String();
+  }
+  // Decoding never grows a value and every value sits in the request
+  // buffer, so this always holds the whole thing. Network task only.
+  static char decoded[HTTP_REQUEST_BUFFER_SIZE];
+  copyAlpacaParam(value, decoded, sizeof(decoded));
+  return String(decoded);
+}
+
+bool HttpConnection::copyArg(const char *name, char *out,
+                             size_t size) const {
+  AlpacaParamValue value;
+  bool truncated;
+  if (!findArg(name, value)) {
+    return false;
+  }
+  copyAlpacaParam(value, out, size, &truncated);
+  return !truncated;
+}
+
+void HttpConnection::collectAlpacaParams(AlpacaParams &params) const {
+  memset(&params, 0, sizeof(params));
+  parseAlpacaParamString(query, queryLength, params);
+  if (isFormBody(contentType)) {
+    parseAlpacaParamString(body, bodyLength, params);
+  }
+}
+
+void HttpConnection::sendHeader(const char *name, const char *value) {
+  int n = snprintf(extraHeaders + extraHeadersLength,
+                   sizeof(extraHeaders) - extraHeadersLength, "%s: %s\r\n",
+                   name, value);
+  if (n > 0 && extraHeadersLength + n < sizeof(extraHeaders)) {
+    extraHeadersLength += n;
+  }
+}
+
+static const char *httpStatusText(int code) {
+  switch (code) {
+  case 200:
+    return "OK";
+  case 202:
+    return "Accepted";
+  case 400:
+    return "Bad Request";
+  case 403:
+    return "Forbidden";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 409:
+    return "Conflict";
+  case 413:
+    return "Payload Too Large";
+  case 431:
+    return "Request Header Fields Too Large";
+  case 500:
+    return "Internal Server Error";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return code < 400 ? "OK" : "Error";
+  }
+}
+
+void HttpConnection::send(int code, const char *type, const char *content,
+                          size_t length) {
+  if (responded) {
+    return; // One response per request
+  }
+  responded = true;
+
+  // Header and a small body go out in one write, so one TCP segment
+  char packet[1460];
+  int n = snprintf(packet, sizeof(packet),
+                   "HTTP/1.1 %d %s\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Length: %u\r\n"
+                   "Connection: %s\r\n"
+                   "%.*s\r\n",
+                   code, httpStatusText(code), type, (unsigned)length,
+                   keepAlive ? "keep-alive" : "close",
+                   (int)extraHeadersLength, extraHeaders);
+  if (n < 0 || (size_t)n >= sizeof(packet)) {
+    close();
+    return;
+  }
+  if (reqMethod == HTTP_HEAD) {
+    length = 0;
+  }
+  if (n + length <= sizeof(packet)) {
+    memcpy(packet + n, content, length);
+    client.write((const uint8_t *)packet, n + length);
+  } else {
+    client.write((const uint8_t *)packet, n);
+    client.write((const uint8_t *)content, length);
+  }
+  lastActivityMs = millis();
+}
+
+static int countEventStreams() {
+  int n = 0;
+  for (const HttpConnection &c : httpConnections) {
+    if (c.isStreaming()) {
+      n++;
+    }
+  }
+  return n;
+}
+
+// Set when a stream opens, so the next check sends it the current state
+static bool eventStateStale = true;
+
+bool HttpConnection::beginEventStream() {
+  if (responded || countEventStreams() >= HTTP_MAX_EVENT_STREAMS) {
+    return false;
+  }
+  responded = true;
+  streaming = true;
+  keepAlive = true;
+  // "retry" sets the browser's reconnect delay after a drop
+  static const char header[] = "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/event-stream\r\n"
+                               "Cache-Control: no-cache\r\n"
+                               "Connection: keep-alive\r\n"
+                               "\r\n"
+                               "retry: 3000\n\n";
+  client.write((const uint8_t *)header, sizeof(header) - 1);
+  lastActivityMs = millis();
+  eventStateStale = true;
+  return true;
+}
+
+void HttpConnection::sendEvent(const char *text, size_t length) {
+  if (client.write((const uint8_t *)text, length) != length) {
+    close(); // Peer gone or not reading; it will reconnect
+    return;
+  }
+  lastActivityMs = millis();
+}
+
+// ----------------------------------------------------------------
+// --- WebSocket (RFC 6455) ---
+// /ws upgrades a connection for the UI's command channel. Only what a
+// browser sends is handled: unfragmented, masked frames no larger than the
+// receive buffer. Text frames go to handleWebSocketMessage(); pings are
+// answered; anything else closes the socket (the page reconnects or falls
+// back to plain requests).
+// ----------------------------------------------------------------
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+static int countWebSockets() {
+  int n = 0;
+  for (const HttpConnection &c : httpConnections) {
+    if (c.isWebSocket()) {
+      n++;
+    }
+  }
+  return n;
+}
+
+bool HttpConnection::beginWebSocket() {
+  if (responded || reqMethod != HTTP_GET || webSocketKey[0] == '\0' ||
+      countWebSockets() >= HTTP_MAX_WEBSOCKETS) {
+    return false;
+  }
+
+  // Sec-WebSocket-Accept = base64(SHA-1(key + the RFC's fixed GUID))
+  char keyed[sizeof(webSocketKey) + 36];
+  int keyedLength = snprintf(keyed, sizeof(keyed), "%s%s", webSocketKey,
+                             "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+  unsigned char digest[20];
+  unsigned char accept[32];
+  size_t acceptLength = 0;
+  if (mbedtls_sha1((const unsigned char *)keyed, keyedLength, digest) != 0 ||
+      mbedtls_base64_encode(accept, sizeof(accept) - 1, &acceptLength, digest,
+                            sizeof(digest)) != 0) {
+    return false;
+  }
+  accept[acceptLength] = '\0';
+
+  char header[160];
+  int n = snprintf(header, sizeof(header),
+                   "HTTP/1.1 101 Switching Protocols\r\n"
+                   "Upgrade: websocket\r\n"
+                   "Connection: Upgrade\r\n"
+                   "Sec-WebSocket-Accept: %s\r\n"
+                   "\r\n",
+                   (const char *)accept);
+  client.write((const uint8_t *)header, n);
+  responded = true;
+  websocket = true;
+  keepAlive = true;
+  lastActivityMs = millis();
+  return true;
+}
+
+// Server frames are never masked and never fragmented
+void HttpConnection::sendFrame(uint8_t opcode, const char *data,
+                               size_t length) {
+  if (length > 0xFFFF) {
+    return; // Nothing we send comes close
+  }
+  uint8_t header[4];
+  size_t headerLength = 2;
+  header[0] = 0x80 | opcode; // FIN
+  if (length < 126) {
+    header[1] = length;
+  } else {
+    header[1] = 126;
+    header[2] = length >> 8;
+    header[3] = length & 0xFF;
+    headerLength = 4;
+  }
+  if (client.write(header, headerLength) != headerLength ||
+      client.write((const uint8_t *)data, length) != length) {
+    close(); // Peer gone; the page reconnects
+    return;
+  }
+  lastActivityMs = millis();
+}
+
+void HttpConnection::processWebSocketFrames() {
+  while (active && len >= 2) {
+    uint8_t *frame = (uint8_t *)buf;
+    bool fin = frame[0] & 0x80;
+    uint8_t opcode = frame[0] & 0x0F;
+    bool masked = frame[1] & 0x80;
+    size_t payloadLength = frame[1] & 0x7F;
+    size_t headerLength = 2;
+    if (payloadLength == 126) {
+      if (len < 4) {
+        return;
+      }
+      payloadLength = (frame[2] << 8) | frame[3];
+      headerLength = 4;
+    }
+    size_t frameLength = headerLength + 4 + payloadLength;
+    if (!fin || !masked || payloadLength == 127 ||
+        frameLength > HTTP_REQUEST_BUFFER_SIZE) {
+      close(); // Fragmented, unmasked or too large: not a browser UI frame
+      return;
+    }
+    if (len < frameLength) {
+      return; // Rest of the frame still arriving
+    }
+
+    // Unmask in place; buf keeps one spare byte, so it can be terminated
+    const uint8_t *mask = frame + headerLength;
+    char *payload = buf + headerLength + 4;
+    for (size_t i = 0; i < payloadLength; i++) {
+      payload[i] ^= mask[i & 3];
+    }
+    char saved = payload[payloadLength];
+    payload[payloadLength] = '\0';
+
+    switch (opcode) {
+    case WS_OPCODE_TEXT:
+      handleWebSocketMessage(payload, payloadLength);
+      break;
+    case WS_OPCODE_PING:
+      sendFrame(WS_OPCODE_PONG, payload, payloadLength);
+      break;
+    case WS_OPCODE_PONG:
+      break;
+    default: // Close, binary, continuation
+      if (opcode == WS_OPCODE_CLOSE) {
+        sendFrame(WS_OPCODE_CLOSE, payload, payloadLength < 2 ? 0 : 2);
+      }
+      close();
+      return;
+    }
+    payload[payloadLength] = saved;
+    if (!active) {
+      return;
+    }
+
+    memmove(buf, buf + frameLength, len - frameLength);
+    len -= frameLength;
+    buf[len] = '\0';
+  }
+}
+
+/**
+ * @brief Sends a text message to every open WebSocket (UI confirmations).
+ */
+void broadcastWebSocketText(const char *text, size_t length) {
+  for (HttpConnection &c : httpConnections) {
+    if (c.isWebSocket()) {
+      c.sendFrame(WS_OPCODE_TEXT, text, length);
+    }
+  }
+}
+
+// Pings quiet sockets, so a page that vanished without a close frame
+// frees its slot once the write fails
+static void pingWebSockets() {
+  static unsigned long lastPingMs = 0;
+  if (millis() - lastPingMs < HTTP_EVENT_HEARTBEAT_MS) {
+    return;
+  }
+  lastPingMs = millis();
+  for (HttpConnection &c : httpConnections) {
+    if (c.isWebSocket()) {
+      c.sendFrame(WS_OPCODE_PING, nullptr, 0);
+    }
+  }
+}
+
+// ----------------------------------------------------------------
+// --- Server-Sent Events ---
+// Every HTTP_EVENT_CHECK_MS the status event is rebuilt (only if a device
+// snapshot moved on) and pushed to every stream when its text changed; the
+// clock goes out as its own small event. A comment line keeps quiet streams
+// from being dropped by proxies and lets the browser notice a dead link.
+// ----------------------------------------------------------------
+static void broadcastEvent(const char *text, size_t length) {
+  for (HttpConnection &c : httpConnections) {
+    if (c.isStreaming()) {
+      c.sendEvent(text, length);
+    }
+  }
+}
+
+static void pushServerEvents() {
+  static unsigned long lastCheckMs = 0;
+  static unsigned long lastSendMs = 0;
+  static uint32_t lastGeneration[MAX_COVER_CALIBRATORS];
+  static char lastStatus[HTTP_EVENT_BUFFER_SIZE];
+  static String lastTime;
+
+  unsigned long now = millis();
+  if (now - lastCheckMs < HTTP_EVENT_CHECK_MS || countEventStreams() == 0) {
+    return;
+  }
+  lastCheckMs = now;
+  bool stale = eventStateStale;
+  eventStateStale = false;
+
+  bool moved = stale;
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    DeviceSnapshot state;
+    readDeviceSnapshot(i, state);
+    moved |= state.generation != lastGeneration[i];
+    lastGeneration[i] = state.generation;
+  }
+
+  char event[HTTP_EVENT_BUFFER_SIZE + 32];
+  if (moved) {
+    char status[HTTP_EVENT_BUFFER_SIZE];
+    size_t length = buildStatusEvent(status, sizeof(status));
+    if (length > 0 && (stale || strcmp(status, lastStatus) != 0)) {
+      memcpy(lastStatus, status, length + 1);
+      int n = snprintf(event, sizeof(event), "event: status\ndata: %s\n\n",
+                       status);
+      broadcastEvent(event, n);
+      lastSendMs = now;
+    }
+  }
+  if (stale || currentTimeString != lastTime) {
+    lastTime = currentTimeString;
+    int n = snprintf(event, sizeof(event), "event: time\ndata: %s\n\n",
+                     lastTime.c_str());
+    broadcastEvent(event, n);
+    lastSendMs = now;
+  }
+  if (now - lastSendMs >= HTTP_EVENT_HEARTBEAT_MS) {
+    broadcastEvent(": ping\n\n", 8);
+    lastSendMs = now;
+  }
+}
+
+void HttpConnection::sendError(int code, const char *message) {
+  keepAlive = false;
+  reqMethod = HTTP_GET;
+  responded = false;
+  extraHeadersLength = 0;
+  send(code, "text/plain", message);
+}
+
+void startHttpEventServer() {
+  httpListener.begin();
+  httpListener.setNoDelay(true);
+  httpListenerRunning = true;
+}
+
+void handleHttpEventServer() {
+  if (!httpListenerRunning) {
+    return;
+  }
+
+  // --- Accept every pending connection ---
+  while (httpListener.hasClient()) {
+    WiFiClient incoming = httpListener.accept();
+    HttpConnection *slot = nullptr;
+    HttpConnection *oldestIdle = nullptr;
+    for (HttpConnection &c : httpConnections) {
+      if (!c.isActive()) {
+        slot = &c;
+        break;
+      }
+      if (c.isIdle() &&
+          (oldestIdle == nullptr || c.idleSince() < oldestIdle->idleSince()))
+        oldestIdle = &c;
+    }
+    if (slot == nullptr && oldestIdle != nullptr) {
+      // All slots busy: recycle the longest-idle keep-alive connection
+      oldestIdle->close();
+      slot = oldestIdle;
+    }
+    if (slot == nullptr) {
+      incoming.print("HTTP/1.1 503 Service Unavailable\r\n"
+                     "Connection: close\r\nContent-Length: 0\r\n\r\n");
+      incoming.stop();
+      continue;
+    }
+    slot->open(incoming);
+  }
+
+  // --- Service every open connection ---
+  for (HttpConnection &c : httpConnections) {
+    if (c.isActive()) {
+      c.poll();
+    }
+  }
+
+  // --- Apply coalesced UI commands, push status changes ---
+  runWebSocketCommands();
+  pingWebSockets();
+  pushServerEvents();
+}
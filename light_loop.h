@@ -0,0 +1,111 @@
+// ================================================================
+// --- EL LIGHT-OUTPUT CONTROL LOOP ---
+// ================================================================
+// PI regulator that trims the EL duty so a photodiode reads a target flux.
+// Pure arithmetic with no Arduino or ESP-IDF dependencies, so it can be
+// built on a PC and run against a simulated panel (tests/light_loop_test.cpp);
+// the hardware side (ADC sampling, LEDC writes) is in el_dimmer.cpp.
+//
+// Everything is normalised: flux as a fraction of the reference full-scale
+// reading, duty as a fraction of full duty. The open-loop duty (tabled and
+// aging-compensated) is the feed-forward, so the loop only corrects what
+// temperature, supply and panel age add on top.
+#ifndef LIGHT_LOOP_H
+#define LIGHT_LOOP_H
+
+struct LightLoopConfig {
+  float kp;          // Duty per unit of flux error
+  float ki;          // Duty per unit of flux error, per update
+  float filterAlpha; // Weight of a new sample in the IIR filter
+  float tolerance;   // Relative flux error that counts as on target
+  float minBand;     // ...but never a tighter band than this (noise floor)
+  int settleUpdates; // On-target updates in a row before "converged"
+  float trimLimit;   // Largest correction, as a fraction of full duty
+};
+
+struct LightLoopState {
+  float filtered;   // IIR-filtered flux
+  bool primed;      // 'filtered' holds a sample
+  float integral;   // Integral trim, fraction of full duty
+  int onTarget;     // Consecutive on-target updates
+  bool converged;
+};
+
+static const LightLoopConfig lightLoopDefaults = {
+    0.5f,  // kp
+    0.05f, // ki
+    0.25f, // filterAlpha
+    0.01f, // tolerance: 1 %
+    0.003f, // minBand: 0.3 % of full scale
+    25,    // settleUpdates
+    0.5f,  // trimLimit
+};
+
+inline void lightLoopReset(LightLoopState &state) {
+  state.filtered = 0;
+  state.primed = false;
+  state.integral = 0;
+  state.onTarget = 0;
+  state.converged = false;
+}
+
+// Feeds one (already oversampled) reading through the IIR filter
+inline float lightLoopFilter(LightLoopState &state,
+                             const LightLoopConfig &config, float sample) {
+  if (!state.primed) {
+    state.filtered = sample;
+    state.primed = true;
+  } else {
+    state.filtered += config.filterAlpha * (sample - state.filtered);
+  }
+  return state.filtered;
+}
+
+inline float lightLoopClamp(float value, float low, float high) {
+  return value < low ? low : (value > high ? high : value);
+}
+
+/**
+ * @brief One regulator update.
+ * @param target Wanted flux (fraction of full scale).
+ * @param feedForward Open-loop duty for that flux (fraction of full duty).
+ * @return The duty to drive (fraction of full duty, 0..1).
+ */
+inline float lightLoopUpdate(LightLoopState &state,
+                             const LightLoopConfig &config, float target,
+                             float feedForward) {
+  float error = target - state.filtered;
+
+  // Integrate unless that would push further into saturation
+  float unclamped = feedForward + config.kp * error + state.integral;
+  bool saturatedHigh = unclamped >= 1.0f && error > 0;
+  bool saturatedLow = unclamped <= 0.0f && error < 0;
+  if (!saturatedHigh && !saturatedLow) {
+    state.integral = lightLoopClamp(state.integral + config.ki * error,
+                                    -config.trimLimit, config.trimLimit);
+  }
+  float trim = lightLoopClamp(config.kp * error + state.integral,
+                              -config.trimLimit, config.trimLimit);
+  float duty = lightLoopClamp(feedForward + trim, 0.0f, 1.0f);
+
+  // Converged once the error has stayed inside the band for a while, or
+  // the output has been pinned at a limit (nothing more the loop can do)
+  float band = config.tolerance * target;
+  if (band < config.minBand) {
+    band = config.minBand;
+  }
+  bool pinned = (duty >= 1.0f && error > 0) || (duty <= 0.0f && error < 0) ||
+                (trim >= config.trimLimit && error > 0) ||
+                (trim <= -config.trimLimit && error < 0);
+  if ((error > -band && error < band) || pinned) {
+    if (state.onTarget < config.settleUpdates) {
+      state.onTarget++;
+    }
+  } else {
+    state.onTarget = 0;
+  }
+  state.converged = state.onTarget >= config.settleUpdates;
+  return duty;
+}
+
+#endif // LIGHT_LOOP_H
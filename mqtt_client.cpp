@@ -0,0 +1,250 @@
+// mqtt_client.cpp
+
+#include "flatcat.h"
+#include <PubSubClient.h>
+
+// ================================================================
+// --- MQTT STATE AND COMMANDS ---
+// ================================================================
+// Optional: with a broker host set on the settings page, each device's state
+// is published to retained topics whenever it changes, and commands posted to
+// its "set" topics go through runControlCommand() exactly like the Alpaca
+// handlers. Topics (N is the Alpaca device number, base defaults to
+// flatcat/<hostname>):
+//   <base>/status                  online / offline (retained, last will)
+//   <base>/N/cover                 NotPresent, Closed, Moving, Open, ...
+//   <base>/N/brightness            0..maxBrightness
+//   <base>/N/calibrator            NotPresent, Off, NotReady, Ready, ...
+//   <base>/N/cover/set        <-   open / close / halt
+//   <base>/N/brightness/set   <-   0..maxBrightness
+// Against a local mosquitto:
+//   mosquitto_sub -v -t 'flatcat/#'
+//   mosquitto_pub -t flatcat/flatcat/0/brightness/set -m 128
+// The broker session (DNS, connects, PubSubClient's blocking socket I/O) runs
+// in its own task so a slow or missing broker never holds up the web server.
+// Commands received there are handed to the network task through a small
+// queue, since only the network task may post to the control task.
+
+#define MQTT_TASK_STACK 4096
+#define MQTT_TASK_PRIORITY 1         // Same as the network task, round robin
+#define MQTT_POLL_MS 20              // mqtt.loop() interval
+#define MQTT_CHECK_MS 100            // How often the snapshots are compared
+#define MQTT_CONNECT_TIMEOUT_MS 2000 // TCP connect to the broker
+#define MQTT_RETRY_MIN_MS 2000       // Reconnect backoff, doubling...
+#define MQTT_RETRY_MAX_MS 60000      // ...up to this
+#define MQTT_RESOLVE_AFTER 5         // Failed connects before a new DNS lookup
+#define MQTT_COMMAND_QUEUE_LENGTH 8  // Power of two
+#define MQTT_TOPIC_SIZE 96
+
+static WiFiClient mqttNet;
+static PubSubClient mqtt(mqttNet);
+static bool mqttEnabled = false;
+static String mqttBase;
+static String mqttClientId;
+
+// Copied from currentSettings by startMqtt(), so the MQTT task never reads
+// Strings the settings page may be rewriting
+static String mqttHost;
+static uint16_t mqttPort;
+static String mqttUser;
+static String mqttPassword;
+
+static IPAddress mqttBrokerIp; // Resolved once, see resolveBroker()
+static bool mqttResolved = false;
+static int mqttFailedConnects = 0;
+
+// MQTT task -> network task
+static SpscQueue<ControlCommand, MQTT_COMMAND_QUEUE_LENGTH> mqttCommands;
+
+// What each topic last said, so only changes are published
+static int publishedCover[MAX_COVER_CALIBRATORS];
+static int publishedBrightness[MAX_COVER_CALIBRATORS];
+static int publishedCalibrator[MAX_COVER_CALIBRATORS];
+static uint32_t publishedGeneration[MAX_COVER_CALIBRATORS];
+
+static const char *coverStateName(int state) {
+  static const char *const names[] = {"NotPresent", "Closed",  "Moving",
+                                      "Open",       "Unknown", "Error"};
+  return (state >= 0 && state <= 5) ? names[state] : "Unknown";
+}
+
+static const char *calibratorStateName(int state) {
+  static const char *const names[] = {"NotPresent", "Off",     "NotReady",
+                                      "Ready",      "Unknown", "Error"};
+  return (state >= 0 && state <= 5) ? names[state] : "Unknown";
+}
+
+static void publishDeviceTopic(int device, const char *name,
+                               const char *value) {
+  char topic[MQTT_TOPIC_SIZE];
+  snprintf(topic, sizeof(topic), "%s/%d/%s", mqttBase.c_str(), device, name);
+  mqtt.publish(topic, value, true);
+}
+
+static void publishChanges(bool force) {
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    DeviceSnapshot state;
+    readDeviceSnapshot(i, state);
+    if (!force && state.generation == publishedGeneration[i]) {
+      continue; // Nothing at all changed on this device
+    }
+    publishedGeneration[i] = state.generation;
+
+    if (force || state.coverState != publishedCover[i]) {
+      publishDeviceTopic(i, "cover", coverStateName(state.coverState));
+      publishedCover[i] = state.coverState;
+    }
+    if (force || state.brightness != publishedBrightness[i]) {
+      publishDeviceTopic(i, "brightness", String(state.brightness).c_str());
+      publishedBrightness[i] = state.brightness;
+    }
+    if (force || state.calibratorState != publishedCalibrator[i]) {
+      publishDeviceTopic(i, "calibrator",
+                         calibratorStateName(state.calibratorState));
+      publishedCalibrator[i] = state.calibratorState;
+    }
+  }
+}
+
+// <base>/N/cover/set and <base>/N/brightness/set
+static void queueCommand(long device, ControlCommandType type, int value) {
+  ControlCommand cmd = {type, (uint8_t)device, value, -1, 0, 0, 0, 0};
+  mqttCommands.push(cmd); // Full: dropped, the state topics still tell
+}
+
+// MQTT task (called back from mqtt.loop())
+static void onMqttMessage(char *topic, uint8_t *payload, unsigned int length) {
+  if (strncmp(topic, mqttBase.c_str(), mqttBase.length()) != 0 ||
+      topic[mqttBase.length()] != '/') {
+    return;
+  }
+  char *end;
+  const char *rest = topic + mqttBase.length() + 1;
+  long device = strtol(rest, &end, 10);
+  if (end == rest || device < 0 || device >= coverCalibratorCount) {
+    return;
+  }
+
+  char value[16];
+  size_t n = length < sizeof(value) - 1 ? length : sizeof(value) - 1;
+  memcpy(value, payload, n);
+  value[n] = '\0';
+
+  if (strcmp(end, "/cover/set") == 0) {
+    if (strcasecmp(value, "open") == 0) {
+      queueCommand(device, CONTROL_OPEN_COVER, 0);
+    } else if (strcasecmp(value, "close") == 0) {
+      queueCommand(device, CONTROL_CLOSE_COVER, 0);
+    } else if (strcasecmp(value, "halt") == 0) {
+      queueCommand(device, CONTROL_HALT_COVER, 0);
+    }
+  } else if (strcmp(end, "/brightness/set") == 0 && isNumeric(value)) {
+    queueCommand(device, CONTROL_SET_BRIGHTNESS, atoi(value));
+  }
+  // The state topics report the outcome (e.g. a refused open stays Closed)
+}
+
+// Looks the broker up once and keeps the address; only a run of failed
+// connects (the broker may have moved) triggers another lookup
+static bool resolveBroker() {
+  if (mqttResolved && mqttFailedConnects < MQTT_RESOLVE_AFTER) {
+    return true;
+  }
+  mqttResolved = mqttBrokerIp.fromString(mqttHost) ||
+                 WiFi.hostByName(mqttHost.c_str(), mqttBrokerIp) == 1;
+  if (mqttResolved) {
+    mqttFailedConnects = 0;
+    mqtt.setServer(mqttBrokerIp, mqttPort);
+  }
+  return mqttResolved;
+}
+
+static bool connectMqtt() {
+  if (!resolveBroker()) {
+    return false;
+  }
+  // Connect the socket ourselves so the timeout is ours, not the stack's
+  if (!mqttNet.connected() &&
+      !mqttNet.connect(mqttBrokerIp, mqttPort, MQTT_CONNECT_TIMEOUT_MS)) {
+    mqttFailedConnects++;
+    return false;
+  }
+  String will = mqttBase + "/status";
+  const char *user = mqttUser.length() > 0 ? mqttUser.c_str() : nullptr;
+  const char *password =
+      mqttPassword.length() > 0 ? mqttPassword.c_str() : nullptr;
+  if (!mqtt.connect(mqttClientId.c_str(), user, password, will.c_str(), 0,
+                    true, "offline")) {
+    mqttNet.stop();
+    mqttFailedConnects++;
+    return false;
+  }
+  mqttFailedConnects = 0;
+  mqtt.publish(will.c_str(), "online", true);
+  String commands = mqttBase + "/+/+/set";
+  mqtt.subscribe(commands.c_str());
+  publishChanges(true); // A new session starts from the full state
+  return true;
+}
+
+static void mqttTask(void *arg) {
+  unsigned long retryMs = MQTT_RETRY_MIN_MS;
+  unsigned long lastCheckMs = 0;
+  for (;;) {
+    if (WiFi.status() != WL_CONNECTED) {
+      vTaskDelay(pdMS_TO_TICKS(MQTT_RETRY_MIN_MS));
+      continue;
+    }
+    if (!mqtt.connected()) {
+      if (!connectMqtt()) {
+        vTaskDelay(pdMS_TO_TICKS(retryMs)); // Back off, nothing else waits
+        retryMs = min(retryMs * 2, (unsigned long)MQTT_RETRY_MAX_MS);
+        continue;
+      }
+      retryMs = MQTT_RETRY_MIN_MS;
+    }
+    mqtt.loop();
+
+    if (millis() - lastCheckMs >= MQTT_CHECK_MS) {
+      lastCheckMs = millis();
+      publishChanges(false);
+    }
+    vTaskDelay(pdMS_TO_TICKS(MQTT_POLL_MS));
+  }
+}
+
+/**
+ * @brief Sets the client up from the settings and starts the MQTT task.
+ * Called once from startMainServer(); without a broker host MQTT stays off.
+ */
+void startMqtt() {
+  mqttEnabled = currentSettings.mqttHost.length() > 0;
+  if (!mqttEnabled) {
+    return;
+  }
+  mqttBase = currentSettings.mqttTopic.length() > 0
+                 ? currentSettings.mqttTopic
+                 : "flatcat/" + currentSettings.hostname;
+  mqttClientId = "flatcat-" + deviceUniqueID;
+  mqttHost = currentSettings.mqttHost;
+  mqttPort = currentSettings.mqttPort;
+  mqttUser = currentSettings.mqttUser;
+  mqttPassword = currentSettings.mqttPassword;
+  mqtt.setCallback(onMqttMessage);
+  xTaskCreatePinnedToCore(mqttTask, "flatcat-mqtt", MQTT_TASK_STACK, nullptr,
+                          MQTT_TASK_PRIORITY, nullptr, NETWORK_TASK_CORE);
+}
+
+/**
+ * @brief Posts the commands the MQTT task received to the control task.
+ * Polled by the network task; never blocks on the broker.
+ */
+void handleMqtt() {
+  if (!mqttEnabled) {
+    return;
+  }
+  ControlCommand cmd;
+  while (mqttCommands.pop(cmd)) {
+    runControlCommand(cmd, nullptr);
+  }
+}
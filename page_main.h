@@ -31,7 +31,7 @@ const char index_html[] PROGMEM = R"rawliteral(
       width: 40px; height: 40px; background: #007BFF;
       cursor: pointer; border-radius: 50%;
     }
-    #sliderValue_1, #sliderValue_2 { font-size: 2rem; font-weight: bold; margin-left: 20px; }
+    .slider-value { font-size: 2rem; font-weight: bold; margin-left: 20px; }
     
     .button-container { margin-top: 20px; }
     .button { padding: 15px 40px; font-size: 1.2rem; font-weight: bold; color: white; border: none; border-radius: 8px; cursor: pointer; width: 150px; transition: background-color 0.2s; }
@@ -59,67 +59,115 @@ const char index_html[] PROGMEM = R"rawliteral(
   <h1>Flatcat Control</h1>
 
   <table>
-    <tr>
-      <td style="width: 100%;">
-        <h3 id="title_1">Waiting...</h3>
-        
-        <h2>Lens Cap 1</h2>
-        <div class="button-container">
-          <button id="servoToggle_1" class="button" onclick="toggleServo(1, openAngleJS, closeAngleJS)">Waiting...</button>
-        </div>
-        
-        <h2>Flat Panel 1</h2>
-        <div class="slider-container">
-          <input type="range" min="0" max="64" value="0" class="slider" id="brightnessSlider_1" oninput="handleSlider(1, this.value)">
-          <span id="sliderValue_1">0</span>
-        </div>
-      </td>
-    </tr>
+    <tr id="columns"></tr>
   </table>
   
   <div id="error-lock" class="error-msg">Error: Turn off dimmers to move servos.</div>
   
   <footer>
     <a href="/settings">Device Settings</a>
-    <a href="/api/v1/management/v1/supporteddevices" target="_blank">Alpaca Status</a>
+    <a href="/management/v1/configureddevices" target="_blank">Alpaca Status</a>
   </footer>
 
+  <!-- One column per configured device; N is the 1-based column number -->
+  <template id="column-template">
+    <td>
+      <h3 class="title">Waiting...</h3>
+      
+      <h2>Lens Cap N</h2>
+      <div class="button-container">
+        <button class="button servo-toggle">Waiting...</button>
+      </div>
+      
+      <h2>Flat Panel N</h2>
+      <div class="slider-container">
+        <input type="range" min="0" max="1023" value="0" class="slider">
+        <span class="slider-value">0</span>
+      </div>
+    </td>
+  </template>
+
 <script>
   // --- Constants (Must match C++ code) ---
   const openAngleJS = 90;
   const closeAngleJS = 0;
 
   // --- Get UI Elements ---
-  const slider_1 = document.getElementById('brightnessSlider_1');
-  const output_1 = document.getElementById('sliderValue_1');
-  const servoButton_1 = document.getElementById('servoToggle_1');
+  const columnsRow = document.getElementById('columns');
+  const columnTemplate = document.getElementById('column-template');
   const errorLock = document.getElementById('error-lock');
-  const title_1 = document.getElementById('title_1');
   const clockDisplay = document.getElementById('clock');
 
-  // --- Global State Variables ---
-  let currentServoState_1 = closeAngleJS; 
-  let isDimmerOn = false;
+  // --- Per-column state, filled in by buildColumns() ---
+  // { slider, output, servoButton, title, servoState }
+  let columns = [];
 
   // --- Page Load ---
   window.onload = function() {
     console.log("DEBUG: Page Loaded. Starting Fetches...");
 
-    updateAllStatus(); // Run once immediately
-    setInterval(updateAllStatus, 2000); // Poll every 2 seconds
-
-    // Start the clock
-    updateClock(); 
-    setInterval(updateClock, 1000); 
-      
-    // Fetch settings for titles (Once is fine)
+    // Settings tell us how many columns to draw and their titles
     fetch('/getsettings')
       .then(response => response.json())
       .then(data => {
-        title_1.innerHTML = data.title1;
+        buildColumns(data);
+        startStatusStream();
+        startCommandSocket();
       });
   };
 
+  // --- Status Updates ---
+  // The device pushes status and clock changes over /events. If the stream
+  // is refused (too many tabs, AP mode) or the browser has no EventSource,
+  // fall back to polling like before.
+  let polling = false;
+
+  function startStatusStream() {
+    if (!window.EventSource) { startPolling(); return; }
+    const source = new EventSource('/events');
+    source.addEventListener('status', e => applyStatus(JSON.parse(e.data)));
+    source.addEventListener('time', e => { clockDisplay.innerHTML = e.data; });
+    source.onerror = function() {
+      // A dropped stream reconnects by itself; a refused one is CLOSED
+      if (source.readyState === EventSource.CLOSED) { startPolling(); }
+    };
+  }
+
+  function startPolling() {
+    if (polling) { return; }
+    polling = true;
+    updateClock();
+    setInterval(updateClock, 1000);
+    updateAllStatus(); // Run once immediately
+    setInterval(updateAllStatus, 2000); // Poll every 2 seconds
+  }
+
+  function buildColumns(settings) {
+    columnsRow.innerHTML = '';
+    columns = [];
+    const count = settings.deviceCount || 1;
+    for (let n = 1; n <= count; n++) {
+      const cell = columnTemplate.content.firstElementChild.cloneNode(true);
+      cell.style.width = (100 / count) + '%';
+      cell.querySelectorAll('h2').forEach(h => {
+        h.innerHTML = h.innerHTML.replace('N', n);
+      });
+      const col = {
+        slider: cell.querySelector('.slider'),
+        output: cell.querySelector('.slider-value'),
+        servoButton: cell.querySelector('.servo-toggle'),
+        title: cell.querySelector('.title'),
+        servoState: closeAngleJS
+      };
+      col.title.innerHTML = settings['title' + n];
+      col.slider.max = settings.maxBrightness;
+      col.slider.oninput = function() { handleSlider(n, this.value); };
+      col.servoButton.onclick = function() { toggleServo(n); };
+      columns.push(col);
+      columnsRow.appendChild(cell);
+    }
+  }
+
   function updateAllStatus() {
     // Fetch all statuses
     fetch('/getallstatus')
@@ -129,24 +177,30 @@ const char index_html[] PROGMEM = R"rawliteral(
       })
       .then(data => {
         // console.log("DEBUG: /getallstatus data:", data);
-        
-        // Use the REAL state (from sensors) to update the UI
-        let realState = data.coverState; // 1=Closed, 3=Open, 4=Unknown
-        updateButtonStateFromSensor(1, realState);
-        
-        // Only update slider if user is NOT dragging it? 
-        // For now, simpler to just update, might cause jitter if active use.
-        // Better: Only update if document.activeElement !== slider_1
-        if (document.activeElement !== slider_1) {
-             slider_1.value = data.dimmer1;
-             output_1.innerHTML = data.dimmer1;
-        }
-        checkDimmerLock();
+        applyStatus(data);
       })
       .catch(err => {
         console.error("ERROR fetching /getallstatus:", err);
       });
   }
+
+  // Same shape from /getallstatus and the "status" event
+  function applyStatus(data) {
+    data.devices.forEach((dev, i) => {
+      if (i >= columns.length) { return; }
+      const col = columns[i];
+
+      // Use the REAL state (from sensors) to update the UI
+      updateButtonStateFromSensor(i + 1, dev.coverState); // 1=Closed, 3=Open, 4=Unknown
+
+      // Only update the slider while the user is not dragging it
+      if (document.activeElement !== col.slider) {
+        col.slider.value = dev.dimmer;
+        col.output.innerHTML = dev.dimmer;
+      }
+    });
+    checkDimmerLock();
+  }
   
   // --- Clock Function ---
   function updateClock() {
@@ -157,67 +211,107 @@ const char index_html[] PROGMEM = R"rawliteral(
       });
   }
 
+  // --- Command Socket ---
+  // Slider values go over one WebSocket; the device applies only the newest
+  // at a bounded rate and echoes what it applied to every open page. Without
+  // the socket (refused, AP mode) the slider falls back to /sliderN requests.
+  let commandSocket = null;
+
+  function startCommandSocket() {
+    if (!window.WebSocket) { return; }
+    const socket = new WebSocket('ws://' + location.host + '/ws');
+    socket.onopen = function() { commandSocket = socket; };
+    socket.onmessage = function(e) {
+      const msg = JSON.parse(e.data);
+      if (msg.event === 'brightness') { applyBrightness(msg.device, msg.value); }
+    };
+    socket.onclose = function(e) {
+      const wasOpen = commandSocket === socket;
+      commandSocket = null;
+      if (wasOpen) { setTimeout(startCommandSocket, 3000); } // Dropped: retry
+    };
+  }
+
+  // Confirmed value from the device; leave a slider being dragged alone
+  function applyBrightness(sliderNum, value) {
+    const col = columns[sliderNum - 1];
+    if (!col || document.activeElement === col.slider) { return; }
+    col.slider.value = value;
+    col.output.innerHTML = value;
+    checkDimmerLock();
+  }
+
   // --- Dimmer Functions ---
   function handleSlider(sliderNum, value) {
-    if (sliderNum == 1) { output_1.innerHTML = value; }
+    columns[sliderNum - 1].output.innerHTML = value;
     checkDimmerLock();
-    // Use single-quotes for JS strings
-    fetch('/slider' + sliderNum + '?value=' + value);
+    if (commandSocket) {
+      commandSocket.send(JSON.stringify(
+        { cmd: 'brightness', device: sliderNum, value: Number(value) }));
+    } else {
+      // Use single-quotes for JS strings
+      fetch('/slider' + sliderNum + '?value=' + value);
+    }
   }
   
+  // Each cap is locked while its own panel is lit
   function checkDimmerLock() {
-    isDimmerOn = (slider_1.value > 0);
-    if (isDimmerOn) {
-      servoButton_1.classList.add('disabled');
-      errorLock.style.display = 'block';
-    } else {
-      servoButton_1.classList.remove('disabled');
-      errorLock.style.display = 'none';
-    }
+    let anyLocked = false;
+    columns.forEach(col => {
+      if (col.slider.value > 0) {
+        col.servoButton.classList.add('disabled');
+        anyLocked = true;
+      } else if (!col.servoButton.innerHTML.startsWith('Moving')) {
+        col.servoButton.classList.remove('disabled');
+      }
+    });
+    errorLock.style.display = anyLocked ? 'block' : 'none';
   }
 
   // --- Servo Functions ---
   
-  // NEW: Update UI based on ASCOM State (1=Closed, 2=Moving, 3=Open)
+  // NEW: Update UI based on ASCOM State (1=Closed, 2=Moving, 3=Open, 5=Error)
   function updateButtonStateFromSensor(servoNum, state) {
-    let button = servoButton_1;
+    const col = columns[servoNum - 1];
+    let button = col.servoButton;
     if (state == 3) { // OPEN
       button.innerHTML = 'Close'; // Next Action
-      button.className = 'button btn-red';
-      currentServoState_1 = openAngleJS; // Sync angle variable
+      button.className = 'button servo-toggle btn-red';
+      col.servoState = openAngleJS; // Sync angle variable
     } else if (state == 1 || state == 4) { // CLOSED or UNKNOWN (4) -> Allow Open
       button.innerHTML = 'Open'; 
-      button.className = 'button btn-green';
-      currentServoState_1 = closeAngleJS; // Sync angle variable
+      button.className = 'button servo-toggle btn-green';
+      col.servoState = closeAngleJS; // Sync angle variable
+    } else if (state == 5) { // ERROR: the last move stalled -> offer a retry
+      button.innerHTML = 'Stalled - Close';
+      button.className = 'button servo-toggle btn-red';
+      col.servoState = openAngleJS; // Next click closes
     } else {
-      // Moving (2) or Error
+      // Moving (2)
       button.innerHTML = 'Moving...';
-      button.className = 'button disabled';
+      button.className = 'button servo-toggle disabled';
     }
-    checkDimmerLock();
   }
 
-  // Fallback for click events (optimistic update)
+  // Optimistic update for immediate click feedback
   function updateButtonState(servoNum, angle) {
-     // ... legacy simple toggle logic if needed, but we mostly rely on sensors now
-     // For immediate click feedback:
-    let button = servoButton_1;
+    let button = columns[servoNum - 1].servoButton;
     if (angle == openAngleJS) {
       button.innerHTML = 'Close';
-      button.className = 'button btn-red';
+      button.className = 'button servo-toggle btn-red';
     } else {
       button.innerHTML = 'Open';
-      button.className = 'button btn-green';
+      button.className = 'button servo-toggle btn-green';
     }
     checkDimmerLock();
   }
 
   function toggleServo(servoNum) {
-    if (isDimmerOn) { return; } // Do nothing
-    let currentState = currentServoState_1;
+    const col = columns[servoNum - 1];
+    if (col.slider.value > 0) { return; } // Do nothing while its panel is lit
     let newState = 0;
     let command = '';
-    if (currentState == openAngleJS) {
+    if (col.servoState == openAngleJS) {
       command = '/close' + servoNum; 
       newState = closeAngleJS;
     } else {
@@ -225,7 +319,7 @@ const char index_html[] PROGMEM = R"rawliteral(
       newState = openAngleJS;
     }
     fetch(command);
-    currentServoState_1 = newState;
+    col.servoState = newState;
     updateButtonState(servoNum, newState);
   }
 </script>
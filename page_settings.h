@@ -20,6 +20,8 @@ const char settings_html[] PROGMEM = R"rawliteral(
     button { padding: 10px 20px; font-size: 1.1em; background-color: #007BFF; color: white; border: none; border-radius: 4px; cursor: pointer; }
     a { color: #007BFF; text-decoration: none; }
     hr { border: 0; border-top: 1px solid #eee; margin: 20px 0; }
+    table { width: 100%; border-collapse: collapse; }
+    td input { width: 90%; padding: 4px; }
   </style>
 </head>
 <body>
@@ -33,6 +35,80 @@ const char settings_html[] PROGMEM = R"rawliteral(
       <label for="title2">Column 2 Title</label>
       <input type="text" id="title2" name="title2">
     </div>
+    <div>
+      <label for="deviceCount">Cover Calibrators in Use</label>
+      <select id="deviceCount" name="deviceCount">
+        <option value="1">1 (Column 1 only)</option>
+        <option value="2">2 (Columns 1 and 2)</option>
+      </select>
+    </div>
+    <div>
+      <label for="rampTimeMs">Brightness Ramp (ms, 0 = instant)</label>
+      <input type="number" id="rampTimeMs" name="rampTimeMs" min="0" max="10000" step="50">
+    </div>
+    <div>
+      <label for="elHalfLifeHours">EL Panel Half-Life (hours, 0 = no aging compensation)</label>
+      <input type="number" id="elHalfLifeHours" name="elHalfLifeHours" min="0" max="100000" step="100">
+    </div>
+    <div>
+      <label for="photoFull1">Photodiode Full Scale (mV, 0 = open loop)</label>
+      <input type="number" id="photoFull1" name="photoFull1" min="0">
+      <input type="number" id="photoFull2" name="photoFull2" min="0">
+    </div>
+    <div>
+      <label>EL Panel On-Time (full-brightness hours)</label>
+      <span id="elHours1">-</span>
+      <input type="checkbox" id="resetElHours1" name="resetElHours1" value="1"> Reset (new panel)
+      <br>
+      <span id="elHours2">-</span>
+      <input type="checkbox" id="resetElHours2" name="resetElHours2" value="1"> Reset (new panel)
+    </div>
+    <hr>
+    <div>
+      <label for="servoSpeed">Cap Speed (degrees/s)</label>
+      <input type="number" id="servoSpeed" name="servoSpeed" min="1" max="720">
+    </div>
+    <div>
+      <label for="servoAccel">Cap Acceleration (degrees/s&sup2;)</label>
+      <input type="number" id="servoAccel" name="servoAccel" min="1" max="720">
+    </div>
+    <div>
+      <label for="servoDecel">Cap Deceleration (degrees/s&sup2;)</label>
+      <input type="number" id="servoDecel" name="servoDecel" min="1" max="720">
+    </div>
+    <div>
+      <label for="stallMarginPct">Stall Margin (% over learned travel time)</label>
+      <input type="number" id="stallMarginPct" name="stallMarginPct" min="0" max="500">
+    </div>
+    <hr>
+    <div>
+      <label for="groups1">Group Commands: Groups (comma-separated, per column)</label>
+      <input type="text" id="groups1" name="groups1" placeholder="Column 1, e.g. roof,all">
+      <input type="text" id="groups2" name="groups2" placeholder="Column 2">
+    </div>
+    <div>
+      <label for="groupKey">Group Command Key (<span id="groupKeyState">not set</span>)</label>
+      <input type="password" id="groupKey" name="groupKey" placeholder="Leave empty to keep">
+      <input type="checkbox" id="clearGroupKey" name="clearGroupKey" value="1"> Clear (turns group commands off)
+    </div>
+    <hr>
+    <div>
+      <label for="mqttHost">MQTT Broker (host or IP, empty = off)</label>
+      <input type="text" id="mqttHost" name="mqttHost" placeholder="e.g. 192.168.1.10">
+      <label for="mqttPort">MQTT Port</label>
+      <input type="number" id="mqttPort" name="mqttPort" min="1" max="65535">
+    </div>
+    <div>
+      <label for="mqttUser">MQTT User (empty = no login)</label>
+      <input type="text" id="mqttUser" name="mqttUser">
+      <label for="mqttPassword">MQTT Password (<span id="mqttPasswordState">not set</span>)</label>
+      <input type="password" id="mqttPassword" name="mqttPassword" placeholder="Leave empty to keep">
+      <input type="checkbox" id="clearMqttPassword" name="clearMqttPassword" value="1"> Clear
+    </div>
+    <div>
+      <label for="mqttTopic">MQTT Topic Base (empty = flatcat/hostname)</label>
+      <input type="text" id="mqttTopic" name="mqttTopic">
+    </div>
     <hr>
     <div>
       <label for="gmtOffset">Time Zone (Standard Offset)</label>
@@ -79,6 +155,21 @@ const char settings_html[] PROGMEM = R"rawliteral(
     <button type="submit">Save and Reboot</button>
   </form>
   <br>
+  <h2>Brightness Presets</h2>
+  <form id="presetForm">
+    <p>Recalled over Alpaca with Action "RecallPreset" and the preset name as
+    Parameters. Leave Ramp empty to use the ramp setting above.</p>
+    <table>
+      <thead>
+        <tr><th>Name</th><th>Brightness</th><th>Ramp (ms)</th><th>Dwell (ms)</th></tr>
+      </thead>
+      <tbody id="presetRows"></tbody>
+    </table>
+    <br>
+    <button type="submit">Save Presets</button>
+    <span id="presetStatus"></span>
+  </form>
+  <br>
   <a href="/">Back to Home</a>
 
   <script>
@@ -88,6 +179,29 @@ const char settings_html[] PROGMEM = R"rawliteral(
         .then(data => {
           document.getElementById('title1').value = data.title1;
           document.getElementById('title2').value = data.title2;
+          document.getElementById('deviceCount').value = data.deviceCount;
+          document.getElementById('rampTimeMs').value = data.rampTimeMs;
+          document.getElementById('servoSpeed').value = data.servoSpeed;
+          document.getElementById('servoAccel').value = data.servoAccel;
+          document.getElementById('servoDecel').value = data.servoDecel;
+          document.getElementById('stallMarginPct').value = data.stallMarginPct;
+          document.getElementById('elHalfLifeHours').value = data.elHalfLifeHours;
+          document.getElementById('photoFull1').value = data.photoFull1;
+          document.getElementById('photoFull2').value = data.photoFull2;
+          document.getElementById('groups1').value = data.groups1;
+          document.getElementById('groups2').value = data.groups2;
+          document.getElementById('groupKeyState').innerHTML =
+              data.groupKeySet ? 'set' : 'not set';
+          document.getElementById('mqttHost').value = data.mqttHost;
+          document.getElementById('mqttPort').value = data.mqttPort;
+          document.getElementById('mqttUser').value = data.mqttUser;
+          document.getElementById('mqttPasswordState').innerHTML =
+              data.mqttPasswordSet ? 'set' : 'not set';
+          document.getElementById('mqttTopic').value = data.mqttTopic;
+          data.elHours.forEach((hours, i) => {
+            document.getElementById('elHours' + (i + 1)).innerHTML =
+                'Column ' + (i + 1) + ': ' + hours.toFixed(2);
+          });
           document.getElementById('gmtOffset').value = data.gmtOffset;
           document.getElementById('daylightOffset').value = data.daylightOffset;
           document.getElementById('hostname').value = data.hostname;
@@ -96,7 +210,46 @@ const char settings_html[] PROGMEM = R"rawliteral(
           document.getElementById('subnet').value = data.subnet;
         })
         .catch(error => console.error('Error fetching settings:', error));
+      loadPresets();
     };
+
+    // --- Presets: saved on their own, no reboot ---
+    function loadPresets() {
+      fetch('/getpresets')
+        .then(response => response.json())
+        .then(data => {
+          const rows = document.getElementById('presetRows');
+          rows.innerHTML = '';
+          for (let i = 0; i < data.maxPresets; i++) {
+            const p = data.presets[i] || { name: '', brightness: 0, rampMs: -1, dwellMs: 0 };
+            const row = document.createElement('tr');
+            row.innerHTML =
+                '<td><input type="text" name="name' + i + '" maxlength="15"></td>' +
+                '<td><input type="number" name="brightness' + i + '" min="0"></td>' +
+                '<td><input type="number" name="rampMs' + i + '" min="0" max="10000"></td>' +
+                '<td><input type="number" name="dwellMs' + i + '" min="0" max="60000"></td>';
+            rows.appendChild(row);
+            row.querySelector('[name=name' + i + ']').value = p.name;
+            row.querySelector('[name=brightness' + i + ']').value = p.brightness;
+            row.querySelector('[name=rampMs' + i + ']').value = p.rampMs < 0 ? '' : p.rampMs;
+            row.querySelector('[name=dwellMs' + i + ']').value = p.dwellMs;
+          }
+        })
+        .catch(error => console.error('Error fetching presets:', error));
+    }
+
+    document.getElementById('presetForm').addEventListener('submit', event => {
+      event.preventDefault();
+      fetch('/savepresets', {
+        method: 'POST',
+        body: new URLSearchParams(new FormData(event.target))
+      })
+        .then(response => response.text())
+        .then(text => {
+          document.getElementById('presetStatus').innerHTML = text;
+          loadPresets();
+        });
+    });
   </script>
 </body>
 </html>
@@ -0,0 +1,118 @@
+// presets.cpp
+
+#include "flatcat.h"
+
+// ================================================================
+// --- BRIGHTNESS PRESETS ---
+// ================================================================
+// A small named table (typically one entry per filter: L, R, G, B, Ha, ...)
+// kept in NVS, so imaging PCs recall "Ha" instead of each carrying its own
+// brightness numbers. A preset sets the brightness, the ramp time and a dwell
+// during which the calibrator stays NotReady while the panel settles, all in
+// one control command. Edited from the settings page or the Alpaca Action
+// member; owned by the network task (all handlers run there).
+
+BrightnessPreset brightnessPresets[MAX_BRIGHTNESS_PRESETS];
+
+// Own handle, like the aging and travel stores; the global 'preferences'
+// stays with the settings handlers
+static Preferences presetPrefs;
+
+/**
+ * @brief Loads the preset table; a missing or differently sized table
+ * (older firmware) leaves every slot empty.
+ */
+void loadBrightnessPresets() {
+  memset(brightnessPresets, 0, sizeof(brightnessPresets));
+  presetPrefs.begin("flatcat-preset", true);
+  if (presetPrefs.getBytesLength("table") == sizeof(brightnessPresets)) {
+    presetPrefs.getBytes("table", brightnessPresets,
+                         sizeof(brightnessPresets));
+  }
+  presetPrefs.end();
+  for (BrightnessPreset &preset : brightnessPresets) {
+    preset.name[PRESET_NAME_LENGTH - 1] = '\0';
+  }
+}
+
+void saveBrightnessPresets() {
+  presetPrefs.begin("flatcat-preset", false);
+  presetPrefs.putBytes("table", brightnessPresets, sizeof(brightnessPresets));
+  presetPrefs.end();
+}
+
+// Names go into JSON unescaped, so only plain characters are allowed
+bool isValidPresetName(const char *name) {
+  size_t n = strlen(name);
+  if (n == 0 || n >= PRESET_NAME_LENGTH) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    char c = name[i];
+    if (!isalnum((unsigned char)c) && c != ' ' && c != '-' && c != '_' &&
+        c != '+' && c != '.') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Case-insensitive lookup, -1 if there is no preset of that name
+int findBrightnessPreset(const char *name) {
+  for (int i = 0; i < MAX_BRIGHTNESS_PRESETS; i++) {
+    if (brightnessPresets[i].name[0] != '\0' &&
+        strcasecmp(brightnessPresets[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Creates or replaces a preset (not saved to NVS yet). Values are
+ * clamped to their ranges; a rampMs of -1 means the rampTimeMs setting.
+ * @return false for an invalid name or when the table is full.
+ */
+bool setBrightnessPreset(const char *name, int brightness, int rampMs,
+                         int dwellMs) {
+  if (!isValidPresetName(name)) {
+    return false;
+  }
+  int slot = findBrightnessPreset(name);
+  for (int i = 0; slot < 0 && i < MAX_BRIGHTNESS_PRESETS; i++) {
+    if (brightnessPresets[i].name[0] == '\0') {
+      slot = i;
+    }
+  }
+  if (slot < 0) {
+    return false;
+  }
+  BrightnessPreset &preset = brightnessPresets[slot];
+  strlcpy(preset.name, name, sizeof(preset.name));
+  preset.brightness = constrain(brightness, 0, maxBrightness);
+  preset.rampMs = (rampMs < 0) ? -1 : min(rampMs, EL_MAX_RAMP_MS);
+  preset.dwellMs = constrain(dwellMs, 0, PRESET_MAX_DWELL_MS);
+  return true;
+}
+
+bool deleteBrightnessPreset(const char *name) {
+  int slot = findBrightnessPreset(name);
+  if (slot < 0) {
+    return false;
+  }
+  memset(&brightnessPresets[slot], 0, sizeof(BrightnessPreset));
+  return true;
+}
+
+/**
+ * @brief Applies a preset to a device through the control task.
+ * @return false if the control task did not take it in time; otherwise
+ * 'result' is 0 or BRIGHTNESS_REFUSED.
+ */
+bool recallBrightnessPreset(int device, int index, int *result) {
+  const BrightnessPreset &preset = brightnessPresets[index];
+  ControlCommand cmd = {CONTROL_SET_BRIGHTNESS, (uint8_t)device,
+                        preset.brightness, preset.rampMs, preset.dwellMs,
+                        0, 0, 0};
+  return runControlCommand(cmd, result);
+}
@@ -0,0 +1,302 @@
+// sequence.cpp
+
+#include "flatcat.h"
+
+// ================================================================
+// --- FLAT SEQUENCE ENGINE ---
+// ================================================================
+// Runs a whole flat run on the device: the client uploads a list of steps
+// once and then only watches. Each step optionally moves the cover, then
+// sets a brightness with its own ramp, then holds for a fixed time (the
+// exposure). Steps are timed from a one-shot esp_timer that wakes the
+// control task, and every deadline is computed from the previous one rather
+// than from when the control task got round to it, so a long run does not
+// drift. Only a cover move, whose length is physical, re-anchors the clock.
+//
+// The step list is uploaded by the network task into a per-device staging
+// slot and handed over with CONTROL_START_SEQUENCE; the control task copies
+// it out and owns everything else here. Any manual cover or brightness
+// command for the device aborts its sequence.
+
+#define SEQUENCE_MAX_HOLD_MS 3600000L // One hour per step
+
+struct SequenceProgram {
+  SequenceStep steps[MAX_SEQUENCE_STEPS];
+  int count;
+};
+
+// Network -> control handoff. 'sequenceStaged' is set by the network task
+// once the slot is written and cleared by the control task once it is
+// copied, so each side only touches the slot while it owns it.
+static SequenceProgram stagedPrograms[MAX_COVER_CALIBRATORS];
+static std::atomic<bool> sequenceStaged[MAX_COVER_CALIBRATORS];
+
+// Control task only
+static SequenceProgram runningPrograms[MAX_COVER_CALIBRATORS];
+static esp_timer_handle_t sequenceTimers[MAX_COVER_CALIBRATORS];
+static int64_t sequenceDeadlineUs[MAX_COVER_CALIBRATORS];
+
+static void onSequenceDeadline(void *arg) {
+  notifyControlTask(); // The step logic itself runs in the control task
+}
+
+void initSequenceEngine() {
+  for (int i = 0; i < MAX_COVER_CALIBRATORS; i++) {
+    sequenceStaged[i].store(false);
+    const esp_timer_create_args_t timerArgs = {
+        .callback = onSequenceDeadline,
+        .arg = nullptr,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "flat-sequence",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&timerArgs, &sequenceTimers[i]);
+  }
+}
+
+// ----------------------------------------------------------------
+// --- Step list parsing (network task) ---
+// "brightness,rampMs,holdMs[,open|close];..." An empty brightness leaves
+// the panel as it is, an empty ramp uses the rampTimeMs setting.
+// ----------------------------------------------------------------
+static bool parseSequenceField(const char *&p, long &value, long fallback) {
+  while (*p == ' ')
+    p++;
+  if (*p == ',' || *p == ';' || *p == '\0') {
+    value = fallback;
+    return true;
+  }
+  char *end = nullptr;
+  value = strtol(p, &end, 10);
+  if (end == p)
+    return false;
+  p = end;
+  while (*p == ' ')
+    p++;
+  return *p == ',' || *p == ';' || *p == '\0';
+}
+
+static bool parseSequenceStep(const char *&p, SequenceStep &step) {
+  long brightness, rampMs, holdMs;
+  if (!parseSequenceField(p, brightness, -1) || *p++ != ',' ||
+      !parseSequenceField(p, rampMs, -1) || *p++ != ',' ||
+      !parseSequenceField(p, holdMs, 0)) {
+    return false;
+  }
+  step.cover = SEQUENCE_COVER_NONE;
+  if (*p == ',') {
+    p++;
+    while (*p == ' ')
+      p++;
+    if (strncasecmp(p, "open", 4) == 0) {
+      step.cover = SEQUENCE_COVER_OPEN;
+      p += 4;
+    } else if (strncasecmp(p, "close", 5) == 0) {
+      step.cover = SEQUENCE_COVER_CLOSE;
+      p += 5;
+    }
+    while (*p == ' ')
+      p++;
+  }
+  if (brightness > maxBrightness || rampMs > EL_MAX_RAMP_MS || holdMs < 0 ||
+      holdMs > SEQUENCE_MAX_HOLD_MS) {
+    return false;
+  }
+  step.brightness = (brightness < 0) ? -1 : brightness;
+  step.rampMs = (rampMs < 0) ? -1 : rampMs;
+  step.holdMs = holdMs;
+  return *p == ';' || *p == '\0';
+}
+
+/**
+ * @brief Parses a step list and starts it on 'device'. Network task only.
+ */
+SequenceUploadResult uploadSequence(int device, const char *text) {
+  if (sequenceStaged[device].load(std::memory_order_acquire)) {
+    return SEQUENCE_UPLOAD_BUSY; // The last upload is not taken yet
+  }
+  SequenceProgram &program = stagedPrograms[device];
+  program.count = 0;
+  const char *p = text;
+  while (*p != '\0') {
+    if (program.count == MAX_SEQUENCE_STEPS ||
+        !parseSequenceStep(p, program.steps[program.count])) {
+      return SEQUENCE_UPLOAD_INVALID;
+    }
+    program.count++;
+    if (*p == ';')
+      p++;
+  }
+  if (program.count == 0) {
+    return SEQUENCE_UPLOAD_INVALID;
+  }
+
+  sequenceStaged[device].store(true, std::memory_order_release);
+  ControlCommand cmd = {CONTROL_START_SEQUENCE, (uint8_t)device, 0, -1, 0,
+                        0, 0, 0};
+  switch (postControlCommand(cmd, nullptr)) {
+  case CONTROL_POST_APPLIED:
+    return SEQUENCE_UPLOAD_STARTED;
+  case CONTROL_POST_TIMED_OUT:
+    return SEQUENCE_UPLOAD_PENDING; // Queued; starts once the task gets to it
+  case CONTROL_POST_QUEUE_FULL:
+    break;
+  }
+  // Never queued, so nothing will take the staged list: release the slot
+  sequenceStaged[device].store(false, std::memory_order_release);
+  return SEQUENCE_UPLOAD_BUSY;
+}
+
+/**
+ * @brief Formats a device's sequence progress as a JSON object for the
+ * status endpoint and the SequenceStatus action. Any task.
+ */
+void formatSequenceStatus(int device, char *out, size_t size) {
+  DeviceSnapshot state;
+  readDeviceSnapshot(device, state);
+  long remaining = 0;
+  if (state.sequenceState == SEQUENCE_HOLD) {
+    remaining = max((long)(state.sequenceDeadlineMs - millis()), 0L);
+  }
+  snprintf(out, size,
+           "{\"state\":\"%s\",\"step\":%d,\"steps\":%d,"
+           "\"stepRemainingMs\":%ld}",
+           sequenceStateName(state.sequenceState), state.sequenceStep,
+           state.sequenceStepCount, remaining);
+}
+
+// ----------------------------------------------------------------
+// --- Step execution (control task) ---
+// ----------------------------------------------------------------
+static int deviceIndex(const CoverCalibratorDevice &dev) {
+  return &dev - coverCalibrators;
+}
+
+static void armSequenceDeadline(CoverCalibratorDevice &dev, int64_t atUs) {
+  int i = deviceIndex(dev);
+  int64_t now = esp_timer_get_time();
+  int64_t wait = max(atUs - now, (int64_t)0);
+  sequenceDeadlineUs[i] = atUs;
+  dev.sequenceDeadlineMs = millis() + (unsigned long)(wait / 1000);
+  esp_timer_stop(sequenceTimers[i]);
+  esp_timer_start_once(sequenceTimers[i], max(wait, (int64_t)1));
+  dev.sequenceState = SEQUENCE_HOLD;
+}
+
+// Light part of a step, timed from 'anchorUs'
+static void startSequenceLight(CoverCalibratorDevice &dev, int64_t anchorUs) {
+  const SequenceStep &step =
+      runningPrograms[deviceIndex(dev)].steps[dev.sequenceStep];
+  int64_t rampUs = 0;
+  if (step.brightness >= 0) {
+    int stepRampMs =
+        step.rampMs < 0 ? currentSettings.rampTimeMs : step.rampMs;
+    setDimmerValue(dev, step.brightness, step.rampMs, 0);
+    if (dev.rampActive) {
+      // A running ramp is retargeted, so this step's fade starts now and
+      // takes its own ramp time; the fade engine is exact
+      rampUs = (int64_t)stepRampMs * 1000;
+    }
+  }
+  armSequenceDeadline(dev, anchorUs + rampUs + (int64_t)step.holdMs * 1000);
+}
+
+// Starts step dev.sequenceStep at 'anchorUs', or finishes the run
+static void startSequenceStep(CoverCalibratorDevice &dev, int64_t anchorUs) {
+  const SequenceProgram &program = runningPrograms[deviceIndex(dev)];
+  if (dev.sequenceStep >= program.count) {
+    dev.sequenceState = SEQUENCE_DONE;
+    return;
+  }
+  const SequenceStep &step = program.steps[dev.sequenceStep];
+  if (step.cover != SEQUENCE_COVER_NONE) {
+    if (dev.dimmerActive) {
+      setDimmerValue(dev, 0, 0, 0); // The cap never moves with the panel lit
+    }
+    CoverMoveResult result =
+        startCoverMove(dev, step.cover == SEQUENCE_COVER_OPEN);
+    if (result == COVER_MOVE_STARTED) {
+      dev.sequenceState = SEQUENCE_COVER; // Continued in runSequence()
+      return;
+    }
+    if (result == COVER_MOVE_BLOCKED) {
+      dev.sequenceState = SEQUENCE_FAILED;
+      return;
+    }
+  }
+  startSequenceLight(dev, anchorUs);
+}
+
+/**
+ * @brief Starts the staged step list. Called for CONTROL_START_SEQUENCE.
+ * @return 0, or -1 if nothing was staged.
+ */
+int startStagedSequence(CoverCalibratorDevice &dev) {
+  int i = deviceIndex(dev);
+  if (!sequenceStaged[i].load(std::memory_order_acquire)) {
+    return -1;
+  }
+  esp_timer_stop(sequenceTimers[i]);
+  runningPrograms[i] = stagedPrograms[i];
+  sequenceStaged[i].store(false, std::memory_order_release);
+
+  dev.sequenceStep = 0;
+  dev.sequenceStepCount = runningPrograms[i].count;
+  startSequenceStep(dev, esp_timer_get_time());
+  return 0;
+}
+
+void abortSequence(CoverCalibratorDevice &dev) {
+  if (!isSequenceRunning(dev)) {
+    return;
+  }
+  esp_timer_stop(sequenceTimers[deviceIndex(dev)]);
+  dev.sequenceState = SEQUENCE_ABORTED;
+}
+
+const char *sequenceStateName(int state) {
+  switch (state) {
+  case SEQUENCE_COVER:
+  case SEQUENCE_HOLD:
+    return "running";
+  case SEQUENCE_DONE:
+    return "done";
+  case SEQUENCE_ABORTED:
+    return "aborted";
+  case SEQUENCE_FAILED:
+    return "failed";
+  }
+  return "idle";
+}
+
+bool isSequenceRunning(const CoverCalibratorDevice &dev) {
+  return dev.sequenceState == SEQUENCE_COVER ||
+         dev.sequenceState == SEQUENCE_HOLD;
+}
+
+/**
+ * @brief Advances a running sequence. Called from every control task pass;
+ * the deadline timer wakes the task at the right moment.
+ */
+void runSequence(CoverCalibratorDevice &dev) {
+  if (dev.sequenceState == SEQUENCE_COVER) {
+    if (isCoverMoving(dev)) {
+      return;
+    }
+    if (dev.coverFault) {
+      dev.sequenceState = SEQUENCE_FAILED; // Stalled; stop the run here
+      return;
+    }
+    startSequenceLight(dev, esp_timer_get_time()); // Re-anchor after travel
+  }
+
+  // Zero-length steps chain straight on, still on the planned timeline
+  while (dev.sequenceState == SEQUENCE_HOLD) {
+    int64_t deadline = sequenceDeadlineUs[deviceIndex(dev)];
+    if (esp_timer_get_time() < deadline) {
+      return;
+    }
+    dev.sequenceStep++;
+    startSequenceStep(dev, deadline);
+  }
+}
@@ -0,0 +1,281 @@
+// tasks.cpp
+
+#include "flatcat.h"
+
+// ================================================================
+// --- NETWORK / CONTROL TASKS ---
+// ================================================================
+// The control task owns the servo, the EL PWM and the Hall sensors and runs
+// pinned to its own core, so end-stop handling never waits for a slow HTTP
+// client. The network task runs the web servers, discovery and DNS next to
+// the Wi-Fi stack. Handlers reach the hardware only through
+// runControlCommand(), which posts to a lock-free SPSC queue and waits a few
+// milliseconds for the control task to report the outcome, so they can still
+// answer with the real result (e.g. "already open").
+
+#define CONTROL_TASK_STACK 4096
+#define NETWORK_TASK_STACK 8192
+#define CONTROL_TASK_PRIORITY 3 // Above the network task, it never blocks long
+#define NETWORK_TASK_PRIORITY 1
+
+static SpscQueue<ControlCommand, CONTROL_QUEUE_LENGTH> controlQueue;
+static TaskHandle_t controlTaskHandle = nullptr;
+static TaskHandle_t networkTaskHandle = nullptr;
+
+static uint32_t nextControlSequence = 1; // Producer (network task) only
+
+// Commands with a future execution time (group commands), one per device;
+// a newer one replaces an older one. Control task only.
+static ControlCommand deferredCommands[MAX_COVER_CALIBRATORS];
+static bool deferredPending[MAX_COVER_CALIBRATORS];
+static esp_timer_handle_t deferredTimers[MAX_COVER_CALIBRATORS];
+static std::atomic<uint32_t> appliedControlSequence{0};
+static std::atomic<int> appliedControlResult{0};
+
+// --- Control side ---
+static int applyControlCommand(const ControlCommand &cmd) {
+  CoverCalibratorDevice &dev = coverCalibrators[cmd.device];
+  if (cmd.type == CONTROL_SET_BRIGHTNESS && cmd.value > 0 &&
+      isCoverMoving(dev)) {
+    return BRIGHTNESS_REFUSED; // Light over a moving cap; off is always fine
+  }
+  if (cmd.type == CONTROL_OPEN_COVER || cmd.type == CONTROL_CLOSE_COVER ||
+      cmd.type == CONTROL_HALT_COVER || cmd.type == CONTROL_SET_BRIGHTNESS) {
+    abortSequence(dev); // A client took over the device by hand
+  }
+  switch (cmd.type) {
+  case CONTROL_OPEN_COVER:
+    return startCoverMove(dev, true);
+  case CONTROL_CLOSE_COVER:
+    return startCoverMove(dev, false);
+  case CONTROL_HALT_COVER:
+    haltCover(dev);
+    return 0;
+  case CONTROL_SET_BRIGHTNESS:
+    setDimmerValue(dev, cmd.value, cmd.rampMs, cmd.dwellMs);
+    return 0;
+  case CONTROL_RESET_EL_AGING:
+    resetElAging(dev);
+    return 0;
+  case CONTROL_START_SEQUENCE:
+    return startStagedSequence(dev);
+  case CONTROL_ABORT_SEQUENCE:
+    abortSequence(dev);
+    return 0;
+  case CONTROL_CAPTURE_LIGHT:
+    return captureLightReference(dev);
+  }
+  return 0;
+}
+
+static void onDeferredCommandDue(void *arg) { notifyControlTask(); }
+
+// Applies a command now, acknowledging it if it came from a group
+static int runNow(const ControlCommand &cmd) {
+  int result = applyControlCommand(cmd);
+  if (cmd.groupCounter != 0) {
+    CoverCalibratorDevice &dev = coverCalibrators[cmd.device];
+    bool refused = ((cmd.type == CONTROL_OPEN_COVER ||
+                     cmd.type == CONTROL_CLOSE_COVER) &&
+                    result == COVER_MOVE_BLOCKED) ||
+                   (cmd.type == CONTROL_SET_BRIGHTNESS &&
+                    result == BRIGHTNESS_REFUSED);
+    dev.groupCounter = cmd.groupCounter;
+    dev.groupStatus = refused ? GROUP_STATUS_REFUSED : GROUP_STATUS_DONE;
+    dev.groupLateUs =
+        cmd.atUs ? (int32_t)(esp_timer_get_time() - cmd.atUs) : 0;
+  }
+  return result;
+}
+
+// Runs a command at once, or parks it until its execution time
+static int acceptControlCommand(const ControlCommand &cmd) {
+  int64_t wait = cmd.atUs - esp_timer_get_time();
+  if (cmd.atUs == 0 || wait <= 0) {
+    return runNow(cmd);
+  }
+  deferredCommands[cmd.device] = cmd;
+  deferredPending[cmd.device] = true;
+  esp_timer_stop(deferredTimers[cmd.device]);
+  esp_timer_start_once(deferredTimers[cmd.device], wait);
+  if (cmd.groupCounter != 0) {
+    coverCalibrators[cmd.device].groupCounter = cmd.groupCounter;
+    coverCalibrators[cmd.device].groupStatus = GROUP_STATUS_SCHEDULED;
+  }
+  return 0;
+}
+
+static void controlTask(void *arg) {
+  for (;;) {
+    // 1. Fresh sensor flags first; the open/close checks depend on them
+    for (int i = 0; i < coverCalibratorCount; i++) {
+      updateCoverStatus(coverCalibrators[i]);
+      updateCalibratorStatus(coverCalibrators[i]);
+      accountElOnTime(coverCalibrators[i]);
+    }
+
+    // 2. Apply everything the network task has posted
+    ControlCommand cmd;
+    while (controlQueue.pop(cmd)) {
+      appliedControlResult.store(acceptControlCommand(cmd),
+                                 std::memory_order_relaxed);
+      publishDeviceSnapshot(cmd.device); // Visible before the handler answers
+      appliedControlSequence.store(cmd.sequence, std::memory_order_release);
+      xTaskNotifyGive(networkTaskHandle); // Wake the waiting handler
+    }
+
+    // 3. Finish any move in progress, advance sequences, then publish
+    // whatever changed
+    for (int i = 0; i < coverCalibratorCount; i++) {
+      if (deferredPending[i] &&
+          esp_timer_get_time() >= deferredCommands[i].atUs) {
+        deferredPending[i] = false;
+        runNow(deferredCommands[i]);
+      }
+      checkAndStopServo(coverCalibrators[i]);
+      runSequence(coverCalibrators[i]);
+      publishDeviceSnapshot(i);
+    }
+
+    // Sleep until the next poll, or until a command is posted
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONTROL_TASK_PERIOD_MS));
+  }
+}
+
+// Wakes the control task from another task (e.g. an esp_timer callback)
+void notifyControlTask() {
+  if (controlTaskHandle != nullptr) {
+    xTaskNotifyGive(controlTaskHandle);
+  }
+}
+
+// Wakes the control task from an interrupt (e.g. LEDC fade end)
+void IRAM_ATTR notifyControlTaskFromISR() {
+  if (controlTaskHandle == nullptr) {
+    return;
+  }
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(controlTaskHandle, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+// --- Producer side (network task only) ---
+ControlPostResult postControlCommand(ControlCommand cmd, int *result) {
+  cmd.sequence = nextControlSequence++;
+
+  // Before the tasks exist (setup) there is nobody to race with
+  if (controlTaskHandle == nullptr) {
+    int r = applyControlCommand(cmd);
+    publishDeviceSnapshot(cmd.device);
+    if (result) {
+      *result = r;
+    }
+    return CONTROL_POST_APPLIED;
+  }
+
+  if (!controlQueue.push(cmd)) {
+    return CONTROL_POST_QUEUE_FULL; // The control task is not keeping up
+  }
+  xTaskNotifyGive(controlTaskHandle);
+
+  const TickType_t timeout = pdMS_TO_TICKS(CONTROL_REPLY_TIMEOUT_MS);
+  TickType_t start = xTaskGetTickCount();
+  for (;;) {
+    // Commands are applied in order, so once our sequence shows up the
+    // result slot holds our answer.
+    if (appliedControlSequence.load(std::memory_order_acquire) ==
+        cmd.sequence) {
+      if (result) {
+        *result = appliedControlResult.load(std::memory_order_relaxed);
+      }
+      return CONTROL_POST_APPLIED;
+    }
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    if (elapsed >= timeout) {
+      return CONTROL_POST_TIMED_OUT; // Will be applied, just not reported
+    }
+    ulTaskNotifyTake(pdTRUE, timeout - elapsed);
+  }
+}
+
+// For handlers that only care whether they have an answer
+bool runControlCommand(ControlCommand cmd, int *result) {
+  return postControlCommand(cmd, result) == CONTROL_POST_APPLIED;
+}
+
+// The common case: no ramp/dwell override
+bool runControlCommand(int device, ControlCommandType type, int value,
+                       int *result) {
+  ControlCommand cmd = {type, (uint8_t)device, value, -1, 0, 0, 0, 0};
+  return runControlCommand(cmd, result);
+}
+
+// --- Network side ---
+static void updateTimeString() {
+  if (millis() - lastTimeUpdate <= 1000) {
+    return;
+  }
+  lastTimeUpdate = millis();
+
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo) || timeinfo.tm_year < 100) {
+    currentTimeString = "Syncing...";
+  } else {
+    char timeString[20];
+    strftime(timeString, sizeof(timeString), "%I:%M:%S %p", &timeinfo);
+    currentTimeString = timeString;
+  }
+}
+
+static void networkTask(void *arg) {
+  for (;;) {
+    // 1. Process web clients: the stock WebServer (captive portal) and the
+    // keep-alive event server (main UI and Alpaca). Only one is ever started.
+    server.handleClient();
+    handleHttpEventServer();
+
+    // 2. Process background discovery (Non-blocking UDP)
+    handleAlpacaDiscovery();
+    handleMqtt(); // Broker session, if configured
+
+    // If in AP mode, process DNS requests
+    if (WiFi.status() != WL_CONNECTED) {
+      dnsServer.processNextRequest();
+    }
+
+    updateTimeString();
+    vTaskDelay(1);
+  }
+}
+
+/**
+ * @brief Starts the control and network tasks. Called once at the end of
+ * setup(), after the hardware and the servers are initialised.
+ */
+void startTasks() {
+  loadTravelModels(); // Needs the motion settings, so after loadSettings()
+  loadElAging();
+  initSequenceEngine();
+  initLightLoops();
+  for (int i = 0; i < MAX_COVER_CALIBRATORS; i++) {
+    const esp_timer_create_args_t timerArgs = {
+        .callback = onDeferredCommandDue,
+        .arg = nullptr,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "group-command",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&timerArgs, &deferredTimers[i]);
+  }
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    updateCoverStatus(coverCalibrators[i]);
+    publishDeviceSnapshot(i); // Readers always find a valid snapshot
+  }
+
+  xTaskCreatePinnedToCore(controlTask, "flatcat-ctrl", CONTROL_TASK_STACK,
+                          nullptr, CONTROL_TASK_PRIORITY, &controlTaskHandle,
+                          CONTROL_TASK_CORE);
+  xTaskCreatePinnedToCore(networkTask, "flatcat-net", NETWORK_TASK_STACK,
+                          nullptr, NETWORK_TASK_PRIORITY, &networkTaskHandle,
+                          NETWORK_TASK_CORE);
+}
@@ -0,0 +1,189 @@
+// light_loop_test.cpp
+//
+// Host test for the photodiode regulator in light_loop.h, run against a
+// simulated EL panel: flux follows gain x duty through a first-order lag,
+// and the photodiode adds noise and clips at its full-scale reading.
+// Build and run with CMake (see CMakeLists.txt next to this file).
+
+#include "../light_loop.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+// One update every 5 ms on the device (LIGHT_LOOP_PERIOD_MS)
+#define UPDATES_PER_SECOND 200
+
+// How long the output may stay clipped once full duty is no longer needed:
+// the panel lag plus the reading filter, with no integral to unwind
+#define WINDUP_RELEASE_UPDATES 20
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                                      \
+  do {                                                                        \
+    if (!(cond)) {                                                            \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__);                             \
+      printf(__VA_ARGS__);                                                    \
+      printf("\n");                                                           \
+      failures++;                                                             \
+    }                                                                         \
+  } while (0)
+
+// --- Simulated panel and photodiode ---
+struct Panel {
+  float gain;      // Flux at full duty (1.0 = matches the feed-forward)
+  float lag;       // Fraction of the way to the new flux per update
+  float noise;     // Peak photodiode noise, fraction of full scale
+  float clipLevel; // Photodiode saturates here (fraction of full scale)
+  float flux;
+  unsigned seed;
+};
+
+static Panel makePanel(float gain) {
+  Panel panel = {gain, 0.2f, 0.003f, 10.0f, 0.0f, 1};
+  return panel;
+}
+
+static float readPhotodiode(Panel &panel) {
+  panel.seed = panel.seed * 1103515245u + 12345u;
+  float noise = ((int)(panel.seed >> 16 & 0x7FFF) / 16383.5f - 1.0f) *
+                panel.noise;
+  float reading = panel.flux + noise;
+  return reading > panel.clipLevel ? panel.clipLevel : reading;
+}
+
+static void drivePanel(Panel &panel, float duty) {
+  panel.flux += (panel.gain * duty - panel.flux) * panel.lag;
+}
+
+// One regulator period, as runLightLoop() does it
+static float step(LightLoopState &state, Panel &panel, float target,
+                  float feedForward) {
+  lightLoopFilter(state, lightLoopDefaults, readPhotodiode(panel));
+  float duty = lightLoopUpdate(state, lightLoopDefaults, target, feedForward);
+  drivePanel(panel, duty);
+  return duty;
+}
+
+// Updates until 'converged', or -1 if not within 'limit'
+static int runUntilConverged(LightLoopState &state, Panel &panel,
+                             float target, float feedForward, int limit) {
+  for (int i = 0; i < limit; i++) {
+    step(state, panel, target, feedForward);
+    if (state.converged) {
+      return i + 1;
+    }
+  }
+  return -1;
+}
+
+// --- Settling: an aged/cold/warm panel reaches its target in time ---
+static void testSettling() {
+  const float gains[] = {0.6f, 0.8f, 1.0f, 1.2f};
+  const float targets[] = {0.02f, 0.2f, 0.5f, 0.8f};
+  for (float gain : gains) {
+    for (float target : targets) {
+      float needed = target / gain; // Duty that gives the target
+      if (needed > 1.0f || needed - target > lightLoopDefaults.trimLimit) {
+        continue; // Out of reach; covered by the windup test
+      }
+      Panel panel = makePanel(gain);
+      LightLoopState state;
+      lightLoopReset(state);
+      int updates = runUntilConverged(state, panel, target, target,
+                                      2 * UPDATES_PER_SECOND);
+      CHECK(updates > 0, "gain %.1f target %.2f did not settle in 2 s", gain,
+            target);
+      // Keep running: it must stay locked and on target
+      for (int i = 0; i < UPDATES_PER_SECOND; i++) {
+        step(state, panel, target, target);
+      }
+      float band = fmaxf(0.02f * target, 2 * lightLoopDefaults.minBand);
+      CHECK(fabsf(panel.flux - target) < band,
+            "gain %.1f target %.2f ended at %.4f", gain, target, panel.flux);
+      CHECK(state.converged, "gain %.1f target %.2f lost lock", gain, target);
+    }
+  }
+}
+
+// --- No windup: a long stretch pinned at full duty recovers at once ---
+static void testNoWindupAtFullDuty() {
+  Panel panel = makePanel(0.5f); // Worn panel: 0.9 needs 1.8x full duty
+  LightLoopState state;
+  lightLoopReset(state);
+  float maxIntegral = 0;
+  for (int i = 0; i < 10 * UPDATES_PER_SECOND; i++) {
+    float duty = step(state, panel, 0.9f, 0.9f);
+    CHECK(duty <= 1.0f, "duty %.3f above full", duty);
+    maxIntegral = fmaxf(maxIntegral, fabsf(state.integral));
+  }
+  CHECK(maxIntegral <= lightLoopDefaults.trimLimit + 1e-6f,
+        "integral grew to %.3f while saturated", maxIntegral);
+  CHECK(state.converged, "a pinned output should report converged");
+
+  // The panel warms up and 0.9 comes within reach. The output must come off
+  // full duty as soon as the reading gets there, not after a stored-up
+  // integral has unwound, and the loop must settle from scratch: the
+  // "converged" it reported while pinned does not count.
+  panel.gain = 1.0f;
+  state.converged = false;
+  state.onTarget = 0;
+  int leftClip = -1;
+  int updates = -1;
+  for (int i = 0; i < 2 * UPDATES_PER_SECOND; i++) {
+    float duty = step(state, panel, 0.9f, 0.9f);
+    if (duty < 1.0f && leftClip < 0) {
+      leftClip = i + 1;
+    }
+    if (state.converged && updates < 0) {
+      updates = i + 1;
+    }
+  }
+  CHECK(leftClip > 0 && leftClip <= WINDUP_RELEASE_UPDATES,
+        "stayed at full duty for %d updates after the panel recovered",
+        leftClip);
+  CHECK(updates > 0, "did not settle after leaving saturation");
+  CHECK(fabsf(panel.flux - 0.9f) < 0.02f * 0.9f,
+        "ended at %.4f after saturation", panel.flux);
+}
+
+// --- Photodiode saturation: the loop stays bounded and recovers ---
+static void testPhotodiodeSaturation() {
+  Panel panel = makePanel(1.0f);
+  panel.clipLevel = 0.6f; // Reference captured too low: reads clip at 0.6
+  LightLoopState state;
+  lightLoopReset(state);
+  float target = 0.8f;
+  for (int i = 0; i < 10 * UPDATES_PER_SECOND; i++) {
+    float duty = step(state, panel, target, target);
+    CHECK(duty <= target + lightLoopDefaults.trimLimit + 1e-6f &&
+              duty <= 1.0f,
+          "duty %.3f past the trim limit while the reading is clipped", duty);
+  }
+  CHECK(fabsf(state.integral) <= lightLoopDefaults.trimLimit + 1e-6f,
+        "integral %.3f unbounded with a clipped reading", state.integral);
+
+  // The clip goes away (reference recaptured): back on target
+  panel.clipLevel = 10.0f;
+  int updates = -1;
+  for (int i = 0; i < 3 * UPDATES_PER_SECOND; i++) {
+    step(state, panel, target, target);
+    if (i > 20 && state.converged && updates < 0) {
+      updates = i + 1;
+    }
+  }
+  CHECK(updates > 0, "did not settle once the photodiode stopped clipping");
+  CHECK(fabsf(panel.flux - target) < 0.02f * target,
+        "ended at %.4f after the clip", panel.flux);
+}
+
+int main() {
+  testSettling();
+  testNoWindupAtFullDuty();
+  testPhotodiodeSaturation();
+  if (failures == 0) {
+    printf("light_loop_test: all passed\n");
+  }
+  return failures == 0 ? 0 : 1;
+}
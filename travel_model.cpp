@@ -0,0 +1,79 @@
+// travel_model.cpp
+
+#include "flatcat.h"
+
+// ================================================================
+// --- CAP TRAVEL-TIME MODEL ---
+// ================================================================
+// Every complete sensor-to-sensor move is timed (from the command to the
+// end-stop edge) and folded into a per-device, per-direction moving average
+// that survives reboots in NVS. The motion engine uses it to report when a
+// move should finish and to declare a stall when a move runs past it by the
+// configured margin. A change of the profile settings or end angles makes
+// the old times meaningless, so they are dropped and learned again.
+// Called from the control task only.
+
+#define TRAVEL_EWMA_WEIGHT 4   // A new sample moves the average by 1/4
+#define TRAVEL_MIN_SAMPLE_MS 50 // Anything faster is a sensor glitch
+
+// The global 'preferences' belongs to the network task's handlers
+static Preferences travelPrefs;
+
+// Identifies the motion settings the learned times belong to
+static uint32_t travelSignature() {
+  uint32_t h = 2166136261u; // FNV-1a over the settings that shape a move
+  const int32_t parts[] = {currentSettings.servoSpeed,
+                           currentSettings.servoAccel,
+                           currentSettings.servoDecel, openAngle, closeAngle};
+  for (int32_t part : parts) {
+    for (int b = 0; b < 4; b++) {
+      h = (h ^ ((part >> (b * 8)) & 0xFF)) * 16777619u;
+    }
+  }
+  return h;
+}
+
+static void travelKey(int device, bool open, char *key, size_t size) {
+  snprintf(key, size, "travel%d%c", device, open ? 'o' : 'c');
+}
+
+/**
+ * @brief Loads the learned travel times for all devices in use, or clears
+ * them when they were learned under different motion settings.
+ */
+void loadTravelModels() {
+  travelPrefs.begin("flatcat-move", false);
+  bool valid = travelPrefs.getUInt("signature", 0) == travelSignature();
+  if (!valid) {
+    travelPrefs.clear();
+    travelPrefs.putUInt("signature", travelSignature());
+  }
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    for (int dir = 0; dir < 2; dir++) {
+      char key[16];
+      travelKey(i, dir == 1, key, sizeof(key));
+      coverCalibrators[i].learnedTravelMs[dir] =
+          valid ? travelPrefs.getUInt(key, 0) : 0;
+    }
+  }
+  travelPrefs.end();
+}
+
+void recordTravelTime(CoverCalibratorDevice &dev, bool open, uint32_t ms) {
+  if (ms < TRAVEL_MIN_SAMPLE_MS) {
+    return;
+  }
+  uint32_t &learned = dev.learnedTravelMs[open ? 1 : 0];
+  if (learned == 0) {
+    learned = ms; // First sample
+  } else {
+    learned = (uint32_t)((int32_t)learned +
+                         ((int32_t)ms - (int32_t)learned) / TRAVEL_EWMA_WEIGHT);
+  }
+
+  char key[16];
+  travelKey(&dev - coverCalibrators, open, key, sizeof(key));
+  travelPrefs.begin("flatcat-move", false);
+  travelPrefs.putUInt(key, learned);
+  travelPrefs.end();
+}
@@ -8,22 +8,14 @@
 
 // --- AP Mode Handlers ---
 void handleNotFound() {
-  String uri = server.uri();
-  uri.toLowerCase();
-
-  // 1. Check if it's an Alpaca API call
-  if (uri.startsWith("/api/v1/") || uri.startsWith("/management/")) {
-    handleAlpacaAPI();
-    return;
-  }
-
+  // Alpaca calls never get here; AlpacaRequestHandler claims them first.
   // If we are in AP mode, redirect everything to the setup page (Captive
   // Portal)
   if (WiFi.status() != WL_CONNECTED) {
-    server.send(200, "text/html", setup_html);
+    http->send(200, "text/html", setup_html);
   } else {
     // In normal mode, just send 404
-    server.send(404, "text/plain", "Not Found");
+    http->send(404, "text/plain", "Not Found");
   }
 }
 
@@ -41,13 +33,13 @@ void handleScan() {
   }
   String json;
   serializeJson(doc, json);
-  server.send(200, "application/json", json);
+  http->send(200, "application/json", json);
 }
 
 void handleSaveWifi() {
   // Serial.println("Saving Wi-Fi credentials...");
-  String ssid = server.arg("ssid");
-  String pass = server.arg("pass");
+  String ssid = http->arg("ssid");
+  String pass = http->arg("pass");
   // ... (logic to determine ssid) ...
 
   // CRITICAL: Must be 'false' for WRITE access
@@ -63,7 +55,7 @@ void handleSaveWifi() {
   preferences.end();
 
   // Serial.println("Credentials saved. Rebooting...");
-  server.send(
+  http->send(
       200, "text/plain",
       "Wi-Fi credentials saved. The device will now reboot in 5 seconds.");
   preferences.begin("flatcat-wifi", true); // TRUE is correct for reading
@@ -78,140 +70,256 @@ void handleSaveWifi() {
 }
 
 // --- Main Server Handlers ---
-void handleRoot() { server.send(200, "text/html", index_html); }
+void handleRoot() { http->send(200, "text/html", index_html); }
 
-void handleSettings() { server.send(200, "text/html", settings_html); }
+void handleSettings() { http->send(200, "text/html", settings_html); }
 
-void handleGetTime() { server.send(200, "text/plain", currentTimeString); }
+void handleGetTime() { http->send(200, "text/plain", currentTimeString); }
 
 // UI Control Handlers
-void handleSlider1() {
-  Serial.println("hi");
-  if (server.hasArg("value")) {
-    int brightness = server.arg("value").toInt();
-
-    // Call the new centralized function
-    setDimmerValue(brightness);
-
-    server.send(200, "text/plain", "OK");
-  } else {
-    server.send(400, "text/plain", "Bad Request");
+// The UI routes end in the 1-based column number (/slider2, /open1, ...).
+// Returns the device index, or -1 (after answering 404) if that column is not
+// configured.
+static int uiDeviceFromPath() {
+  const char *path = http->path();
+  size_t n = strlen(path);
+  while (n > 0 && isDigit(path[n - 1]))
+    n--;
+  int device = atoi(path + n) - 1;
+  if (device < 0 || device >= coverCalibratorCount) {
+    http->send(404, "text/plain", "No such device");
+    return -1;
   }
+  return device;
 }
 
-/* void handleSlider2() {
-  if (server.hasArg("value")) {
-    currentDimmerValue_2 = server.arg("value").toInt();
-    updateDimmerLock();
-    int newBrightness = map(currentDimmerValue_2, 0, 64, 0, 255);
-    analogWrite(elPin_2, newBrightness);
-    server.send(200, "text/plain", "OK");
+void handleSlider() {
+  int device = uiDeviceFromPath();
+  if (device < 0)
+    return;
+  if (http->hasArg("value")) {
+    int brightness = http->arg("value").toInt();
+
+    // Hand it to the control task, which owns the EL PWM
+    int result;
+    if (!runControlCommand(device, CONTROL_SET_BRIGHTNESS, brightness,
+                           &result)) {
+      http->send(503, "text/plain", "Busy");
+    } else if (result == BRIGHTNESS_REFUSED) {
+      http->send(409, "text/plain", "Error: Cover is moving.");
+    } else {
+      http->send(200, "text/plain", "OK");
+    }
   } else {
-    server.send(400, "text/plain", "Bad Request");
+    http->send(400, "text/plain", "Bad Request");
   }
-} */
+}
 
-// --- OPEN HANDLER ---
-void handleOpen1() {
-  Serial.println("DEBUG: handleOpen1 called."); // <--- ADDED
-  if (isDimmerActive) {
-    Serial.println("DEBUG: Blocked by DimmerActive."); // <--- ADDED
-    server.send(409, "text/plain", "Error: Turn off dimmer first.");
+// Shared by the open/close handlers
+static void uiCoverMove(bool open) {
+  int device = uiDeviceFromPath();
+  if (device < 0)
     return;
-  }
-
-  if (isOpenStopActive_1) {
-    Serial.println("DEBUG: Blocked by Sensor (Already Open)."); // <--- ADDED
-    server.send(200, "text/plain", "Cover is already Open.");
+  int result;
+  ControlCommandType type = open ? CONTROL_OPEN_COVER : CONTROL_CLOSE_COVER;
+  if (!runControlCommand(device, type, 0, &result)) {
+    http->send(503, "text/plain", "Busy");
     return;
   }
+  switch (result) {
+  case COVER_MOVE_BLOCKED:
+    http->send(409, "text/plain", "Error: Turn off dimmer first.");
+    break;
+  case COVER_MOVE_ALREADY_THERE:
+    http->send(200, "text/plain",
+               open ? "Cover is already Open." : "Cover is already Closed.");
+    break;
+  case COVER_MOVE_STARTED:
+    http->send(200, "text/plain", open ? "Opening" : "Closing");
+    break;
+  }
+}
 
-  // NEW: Attach, set flags, and command move
-  Serial.println("DEBUG: Attaching servo..."); // <--- ADDED
-  myServo_1.attach(servoPin_1);
-  isMovingToClose_1 = false; // Ensure the opposite flag is clear
-  isMovingToOpen_1 = true;   // Set the target flag
-  coverState_1 = coverMoving;
-
-  Serial.print("DEBUG: Writing Angle: ");
-  Serial.println(openAngle);  // <--- ADDED
-  myServo_1.write(openAngle); // Command the full travel angle
+// --- OPEN HANDLER ---
+void handleOpen() { uiCoverMove(true); }
 
-  // DEBUG: Force wait to ensure signal generates
-  Serial.println("DEBUG: Blocking wait 1000ms...");
-  delay(1000);
+// --- CLOSE HANDLER ---
+void handleClose() { uiCoverMove(false); }
 
-  currentServoAngle_1 = openAngle;
+void handleGetAllStatus() {
+  StaticJsonDocument<1536> doc;
+  doc["deviceCount"] = coverCalibratorCount;
+  JsonArray devices = doc.createNestedArray("devices");
+
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    DeviceSnapshot state;
+    readDeviceSnapshot(i, state);
+
+    JsonObject dev = devices.createNestedObject();
+    dev["servo"] = state.servoAngle;
+    dev["dimmer"] = state.brightness;
+    // DEBUG: Raw Sensor Values (1=HIGH/No Magnet, 0=LOW/Magnet Present), as
+    // last sampled by the control task
+    dev["d1_raw"] = state.closedStopActive ? 0 : 1;
+    dev["d2_raw"] = state.openStopActive ? 0 : 1;
+    dev["coverState"] = state.coverState; // 1=Closed, 2=Moving, 3=Open, 5=Error
+    dev["fault"] = state.coverFault;
+    // Move timing: expected duration and time left, from the learned model
+    unsigned long elapsed = millis() - state.moveStartMs;
+    dev["expectedMs"] = state.expectedMoveMs;
+    dev["etaMs"] = (state.moving && elapsed < state.expectedMoveMs)
+                       ? state.expectedMoveMs - elapsed
+                       : 0;
+    dev["learnedOpenMs"] = state.learnedOpenMs;
+    dev["learnedCloseMs"] = state.learnedCloseMs;
+    dev["elHours"] = state.elCentiHours / 100.0; // Full-duty equivalent
+    JsonObject group = dev.createNestedObject("group"); // Group command ack
+    group["counter"] = state.groupCounter;
+    group["status"] = groupStatusName(state.groupStatus);
+    group["lateUs"] = state.groupLateUs;
+    dev["lightLoop"] = !state.lightLoopEnabled ? "off"
+                       : state.lightLoopLocked ? "locked"
+                                               : "settling";
+    dev["generation"] = state.generation;
+  }
+  String json;
+  serializeJson(doc, json);
+  http->send(200, "application/json", json);
+}
 
-  server.send(200, "text/plain", "Opened");
-  Serial.println("Cover 1 commanded to open.");
+// --- STATUS EVENT STREAM ---
+// The main page listens on /events instead of polling /getallstatus and
+// /gettime. The event server pushes a "status" event (the fields below)
+// when one of them changes and a "time" event when the clock ticks. In AP
+// mode (stock WebServer) this answers 503 and the page falls back to
+// polling.
+void handleEventStream() {
+  if (!http->beginEventStream()) {
+    http->send(503, "text/plain", "Event stream not available.");
+  }
 }
 
-// --- CLOSE HANDLER ---
-void handleClose1() {
-  Serial.println("DEBUG: handleClose1 called."); // <--- ADDED
-  if (isDimmerActive) {
-    Serial.println("DEBUG: Blocked by DimmerActive."); // <--- ADDED
-    server.send(409, "text/plain", "Error: Turn off dimmer first.");
-    return;
+// --- WEBSOCKET COMMAND CHANNEL ---
+// The slider sends {"cmd":"brightness","device":N,"value":V} (N 1-based,
+// like the UI routes) on every input event over /ws. Values are only noted
+// here; runWebSocketCommands() hands the newest one per device to the
+// control task at most every WS_BRIGHTNESS_INTERVAL_MS, and tells every
+// page what was applied: {"event":"brightness","device":N,"value":V}.
+// Network task only.
+static bool wsPending[MAX_COVER_CALIBRATORS];
+static int wsPendingBrightness[MAX_COVER_CALIBRATORS];
+static unsigned long wsAppliedMs[MAX_COVER_CALIBRATORS];
+
+void handleWebSocket() {
+  if (!http->beginWebSocket()) {
+    http->send(503, "text/plain", "WebSocket not available.");
   }
+}
 
-  if (isClosedStopActive_1) {
-    Serial.println("DEBUG: Blocked by Sensor (Already Closed)."); // <--- ADDED
-    server.send(200, "text/plain", "Cover is already Closed.");
+void handleWebSocketMessage(const char *text, size_t length) {
+  StaticJsonDocument<128> doc;
+  if (deserializeJson(doc, text, length)) {
+    return; // Not JSON; ignore it
+  }
+  const char *cmd = doc["cmd"].as<const char *>();
+  int device = doc["device"].as<int>() - 1;
+  if (cmd == nullptr || device < 0 || device >= coverCalibratorCount) {
     return;
   }
+  if (strcmp(cmd, "brightness") == 0) {
+    wsPendingBrightness[device] = doc["value"].as<int>(); // Newest wins
+    wsPending[device] = true;
+  }
+}
 
-  // NEW: Attach, set flags, and command move
-  Serial.println("DEBUG: Attaching servo..."); // <--- ADDED
-  myServo_1.attach(servoPin_1);
-  isMovingToOpen_1 = false; // Ensure the opposite flag is clear
-  isMovingToClose_1 = true; // Set the target flag
-  coverState_1 = coverMoving;
-
-  Serial.print("DEBUG: Writing Angle: ");
-  Serial.println(closeAngle);  // <--- ADDED
-  myServo_1.write(closeAngle); // Command the full travel angle
-
-  // DEBUG: Force wait to ensure signal generates
-  Serial.println("DEBUG: Blocking wait 1000ms...");
-  delay(1000);
-
-  currentServoAngle_1 = closeAngle;
-
-  server.send(200, "text/plain", "Closed");
-  Serial.println("Cover 1 commanded to close.");
+void runWebSocketCommands() {
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    if (!wsPending[i] ||
+        millis() - wsAppliedMs[i] < WS_BRIGHTNESS_INTERVAL_MS) {
+      continue;
+    }
+    if (!runControlCommand(i, CONTROL_SET_BRIGHTNESS, wsPendingBrightness[i],
+                           nullptr)) {
+      continue; // Queue full; try again with whatever is newest then
+    }
+    wsPending[i] = false;
+    wsAppliedMs[i] = millis();
+
+    DeviceSnapshot state;
+    readDeviceSnapshot(i, state);
+    char confirm[64];
+    int n = snprintf(confirm, sizeof(confirm),
+                     "{\"event\":\"brightness\",\"device\":%d,"
+                     "\"value\":%d}",
+                     i + 1, state.brightness);
+    broadcastWebSocketText(confirm, n);
+  }
 }
 
-void handleGetAllStatus() {
-  StaticJsonDocument<200> doc;
-  doc["servo1"] = currentServoAngle_1;
-  // doc["servo2"] = currentServoAngle_2;
-  doc["dimmer1"] = currentDimmerValue_1;
-  // doc["dimmer2"] = currentDimmerValue_2;
-
-  // DEBUG: Raw Sensor Values (1=HIGH/No Magnet, 0=LOW/Magnet Present)
-  doc["d1_raw"] = digitalRead(closedStopPin_1);
-  doc["d2_raw"] = digitalRead(openStopPin_1);
-  doc["coverState"] = coverState_1; // 1=Closed, 2=Moving, 3=Open
-  String json;
-  serializeJson(doc, json);
-  server.send(200, "application/json", json);
+/**
+ * @brief Writes the status event's JSON (what the main page shows) into
+ * 'out' from the device snapshots.
+ * @return The length written, 0 if it did not fit.
+ */
+size_t buildStatusEvent(char *out, size_t size) {
+  StaticJsonDocument<384> doc;
+  JsonArray devices = doc.createNestedArray("devices");
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    DeviceSnapshot state;
+    readDeviceSnapshot(i, state);
+    JsonObject dev = devices.createNestedObject();
+    dev["coverState"] = state.coverState;
+    dev["dimmer"] = state.brightness;
+    dev["calibratorState"] = state.calibratorState;
+  }
+  size_t length = serializeJson(doc, out, size);
+  return length < size ? length : 0;
 }
 
 void handleGetSettings() {
-  StaticJsonDocument<400> doc;
+  StaticJsonDocument<1536> doc;
   doc["hostname"] = currentSettings.hostname;
   doc["ip"] = currentSettings.ip;
   doc["gateway"] = currentSettings.gateway;
   doc["subnet"] = currentSettings.subnet;
-  doc["title1"] = currentSettings.title1;
-  // doc["title2"] = currentSettings.title2;
+  for (int i = 0; i < MAX_COVER_CALIBRATORS; i++) {
+    char key[12];
+    snprintf(key, sizeof(key), "title%d", i + 1);
+    doc[key] = currentSettings.title[i];
+  }
+  doc["deviceCount"] = currentSettings.deviceCount;
+  doc["maxDevices"] = MAX_COVER_CALIBRATORS;
+  doc["maxBrightness"] = maxBrightness;
+  doc["rampTimeMs"] = currentSettings.rampTimeMs;
+  doc["servoSpeed"] = currentSettings.servoSpeed;
+  doc["servoAccel"] = currentSettings.servoAccel;
+  doc["servoDecel"] = currentSettings.servoDecel;
+  doc["stallMarginPct"] = currentSettings.stallMarginPct;
+  doc["elHalfLifeHours"] = currentSettings.elHalfLifeHours;
+  for (int i = 0; i < MAX_COVER_CALIBRATORS; i++) {
+    char key[12];
+    snprintf(key, sizeof(key), "photoFull%d", i + 1);
+    doc[key] = currentSettings.photoFullScaleMv[i];
+    snprintf(key, sizeof(key), "groups%d", i + 1);
+    doc[key] = currentSettings.groups[i];
+  }
+  doc["groupKeySet"] = currentSettings.groupKey.length() > 0; // Never sent
+  doc["mqttHost"] = currentSettings.mqttHost;
+  doc["mqttPort"] = currentSettings.mqttPort;
+  doc["mqttUser"] = currentSettings.mqttUser;
+  doc["mqttPasswordSet"] = currentSettings.mqttPassword.length() > 0;
+  doc["mqttTopic"] = currentSettings.mqttTopic;
+  JsonArray elHours = doc.createNestedArray("elHours");
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    DeviceSnapshot state;
+    readDeviceSnapshot(i, state);
+    elHours.add(state.elCentiHours / 100.0);
+  }
   doc["gmtOffset"] = currentSettings.gmtOffset;
   doc["daylightOffset"] = currentSettings.daylightOffset;
   String json;
   serializeJson(doc, json);
-  server.send(200, "application/json", json);
+  http->send(200, "application/json", json);
 }
 
 void clearSavedSettings() {
@@ -233,54 +341,201 @@ void handleSave() {
   // Serial.println("Saving new settings...");
   preferences.begin("flatcat", false);
 
-  if (server.hasArg("title1"))
-    preferences.putString("title1", server.arg("title1"));
-  // if (server.hasArg("title2"))
-  //   preferences.putString("title2", server.arg("title2"));
-  if (server.hasArg("gmtOffset"))
-    preferences.putLong("gmtOffset", server.arg("gmtOffset").toInt());
-  if (server.hasArg("daylightOffset"))
-    preferences.putInt("daylightOffset", server.arg("daylightOffset").toInt());
-  if (server.hasArg("hostname"))
-    preferences.putString("hostname", server.arg("hostname"));
-  if (server.hasArg("ip"))
-    preferences.putString("ip", server.arg("ip"));
-  if (server.hasArg("gateway"))
-    preferences.putString("gateway", server.arg("gateway"));
-  if (server.hasArg("subnet"))
-    preferences.putString("subnet", server.arg("subnet"));
+  for (int i = 0; i < MAX_COVER_CALIBRATORS; i++) {
+    char key[12];
+    snprintf(key, sizeof(key), "title%d", i + 1);
+    if (http->hasArg(key))
+      preferences.putString(key, http->arg(key));
+  }
+  if (http->hasArg("deviceCount"))
+    preferences.putInt("deviceCount",
+                       constrain(http->arg("deviceCount").toInt(), 1,
+                                 MAX_COVER_CALIBRATORS));
+  if (http->hasArg("rampTimeMs"))
+    preferences.putInt("rampMs", constrain(http->arg("rampTimeMs").toInt(), 0,
+                                           EL_MAX_RAMP_MS));
+  if (http->hasArg("servoSpeed"))
+    preferences.putInt("srvSpeed", constrain(http->arg("servoSpeed").toInt(),
+                                             1, SERVO_PROFILE_LIMIT));
+  if (http->hasArg("servoAccel"))
+    preferences.putInt("srvAccel", constrain(http->arg("servoAccel").toInt(),
+                                             1, SERVO_PROFILE_LIMIT));
+  if (http->hasArg("servoDecel"))
+    preferences.putInt("srvDecel", constrain(http->arg("servoDecel").toInt(),
+                                             1, SERVO_PROFILE_LIMIT));
+  if (http->hasArg("stallMarginPct"))
+    preferences.putInt("stallMargin",
+                       constrain(http->arg("stallMarginPct").toInt(), 0, 500));
+  if (http->hasArg("elHalfLifeHours"))
+    preferences.putInt("elHalfLife",
+                       constrain(http->arg("elHalfLifeHours").toInt(), 0,
+                                 100000));
+  for (int i = 0; i < MAX_COVER_CALIBRATORS; i++) {
+    char key[12];
+    snprintf(key, sizeof(key), "photoFull%d", i + 1);
+    if (http->hasArg(key))
+      preferences.putInt(key, max((int)http->arg(key).toInt(), 0));
+    snprintf(key, sizeof(key), "groups%d", i + 1);
+    if (http->hasArg(key))
+      preferences.putString(key, http->arg(key));
+  }
+  // The group key is write-only: empty keeps it, the checkbox clears it
+  if (http->hasArg("clearGroupKey")) {
+    preferences.remove("groupKey");
+    resetGroupCounter();
+  } else if (http->arg("groupKey").length() > 0) {
+    preferences.putString("groupKey", http->arg("groupKey"));
+    resetGroupCounter(); // Senders with the new key count from scratch
+  }
+  if (http->hasArg("mqttHost"))
+    preferences.putString("mqttHost", http->arg("mqttHost"));
+  if (http->hasArg("mqttPort"))
+    preferences.putInt("mqttPort",
+                       constrain(http->arg("mqttPort").toInt(), 1, 65535));
+  if (http->hasArg("mqttUser"))
+    preferences.putString("mqttUser", http->arg("mqttUser"));
+  if (http->hasArg("mqttTopic"))
+    preferences.putString("mqttTopic", http->arg("mqttTopic"));
+  if (http->hasArg("clearMqttPassword"))
+    preferences.remove("mqttPass");
+  else if (http->arg("mqttPassword").length() > 0)
+    preferences.putString("mqttPass", http->arg("mqttPassword"));
+  // A replaced panel starts its aging from zero
+  for (int i = 0; i < coverCalibratorCount; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "resetElHours%d", i + 1);
+    if (http->hasArg(key))
+      runControlCommand(i, CONTROL_RESET_EL_AGING, 0, nullptr);
+  }
+  if (http->hasArg("gmtOffset"))
+    preferences.putLong("gmtOffset", http->arg("gmtOffset").toInt());
+  if (http->hasArg("daylightOffset"))
+    preferences.putInt("daylightOffset", http->arg("daylightOffset").toInt());
+  if (http->hasArg("hostname"))
+    preferences.putString("hostname", http->arg("hostname"));
+  if (http->hasArg("ip"))
+    preferences.putString("ip", http->arg("ip"));
+  if (http->hasArg("gateway"))
+    preferences.putString("gateway", http->arg("gateway"));
+  if (http->hasArg("subnet"))
+    preferences.putString("subnet", http->arg("subnet"));
 
   preferences.end();
   // Serial.println("Settings saved. Rebooting.");
-  server.send(200, "text/html", reboot_html);
+  http->send(200, "text/html", reboot_html);
   delay(1000);
   ESP.restart();
 }
 
-// --- DEBUG HANDLER FOR WIFI TOGGLE TEST ---
-void handleTestMove() {
-  server.send(200, "text/plain",
-              "Starting Wireless-Free Move Test in 2 seconds...");
-  delay(2000); // Give time for response to send
-
-  Serial.println("DEBUG: Disabling WiFi for Move...");
-  WiFi.disconnect();
-  WiFi.mode(WIFI_OFF);
-  delay(500);
-
-  Serial.println("DEBUG: Moving Servo...");
-  myServo_1.attach(servoPin_1);
-  // Just wiggle it 0-90-0 to test power
-  myServo_1.write(openAngle);
-  delay(1000);
-  myServo_1.write(closeAngle);
-  delay(1000);
-  myServo_1.detach();
-  Serial.println("DEBUG: Move Complete. Reconnecting WiFi...");
+// --- Flat sequences ---
+// The device is given by its Alpaca number (?device=0, default 0)
+static int sequenceDeviceArg() {
+  int device = http->hasArg("device") ? http->arg("device").toInt() : 0;
+  if (device < 0 || device >= coverCalibratorCount) {
+    http->send(404, "text/plain", "No such device");
+    return -1;
+  }
+  return device;
+}
 
-  // Re-enable WiFi (Logic borrowed from setup)
-  WiFi.begin(currentSettings.ip.c_str(), currentSettings.gateway.c_str());
-  // Actually we need to reload credentials or just restart?
-  // Easier to just restart to ensure clean state
-  ESP.restart();
+// POST steps=brightness,rampMs,holdMs[,open|close];...
+void handleSequenceStart() {
+  int device = sequenceDeviceArg();
+  if (device < 0)
+    return;
+  // Up to MAX_SEQUENCE_STEPS steps is far more than arg() keeps; a cut list
+  // could still parse as a different program, so refuse it instead
+  char steps[ALPACA_ACTION_PARAMETERS_SIZE];
+  if (!http->copyArg("steps", steps, sizeof(steps))) {
+    http->send(400, "text/plain", "Missing or too long steps");
+    return;
+  }
+  switch (uploadSequence(device, steps)) {
+  case SEQUENCE_UPLOAD_STARTED:
+    http->send(200, "text/plain", "Sequence started");
+    break;
+  case SEQUENCE_UPLOAD_PENDING:
+    http->send(202, "text/plain", "Sequence queued");
+    break;
+  case SEQUENCE_UPLOAD_INVALID:
+    http->send(400, "text/plain",
+               "Steps must be brightness,rampMs,holdMs[,open|close] "
+               "separated by ';'");
+    break;
+  case SEQUENCE_UPLOAD_BUSY:
+    http->send(503, "text/plain", "Busy");
+    break;
+  }
+}
+
+void handleSequenceAbort() {
+  int device = sequenceDeviceArg();
+  if (device < 0)
+    return;
+  if (!runControlCommand(device, CONTROL_ABORT_SEQUENCE, 0, nullptr)) {
+    http->send(503, "text/plain", "Busy");
+    return;
+  }
+  http->send(200, "text/plain", "Sequence aborted");
+}
+
+void handleSequenceStatus() {
+  int device = sequenceDeviceArg();
+  if (device < 0)
+    return;
+  char status[128];
+  formatSequenceStatus(device, status, sizeof(status));
+  http->sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
+  http->send(200, "application/json", status);
+}
+
+// --- Brightness presets (settings page) ---
+void handleGetPresets() {
+  StaticJsonDocument<1024> doc;
+  doc["maxPresets"] = MAX_BRIGHTNESS_PRESETS;
+  JsonArray presets = doc.createNestedArray("presets");
+  for (const BrightnessPreset &preset : brightnessPresets) {
+    if (preset.name[0] == '\0') {
+      continue;
+    }
+    JsonObject entry = presets.createNestedObject();
+    entry["name"] = (const char *)preset.name;
+    entry["brightness"] = preset.brightness;
+    entry["rampMs"] = preset.rampMs;
+    entry["dwellMs"] = preset.dwellMs;
+  }
+  String json;
+  serializeJson(doc, json);
+  http->send(200, "application/json", json);
+}
+
+// Replaces the whole table with rows name0/brightness0/rampMs0/dwellMs0, ...
+// Rows with an empty name are dropped. No reboot needed.
+void handleSavePresets() {
+  memset(brightnessPresets, 0, sizeof(brightnessPresets));
+  int rejected = 0;
+  for (int i = 0; i < MAX_BRIGHTNESS_PRESETS; i++) {
+    char key[16];
+    snprintf(key, sizeof(key), "name%d", i);
+    String name = http->arg(key);
+    name.trim();
+    if (name.length() == 0) {
+      continue;
+    }
+    snprintf(key, sizeof(key), "brightness%d", i);
+    int brightness = http->arg(key).toInt();
+    snprintf(key, sizeof(key), "rampMs%d", i);
+    int rampMs = http->hasArg(key) && http->arg(key).length() > 0
+                     ? http->arg(key).toInt()
+                     : -1;
+    snprintf(key, sizeof(key), "dwellMs%d", i);
+    int dwellMs = http->arg(key).toInt();
+    if (!setBrightnessPreset(name.c_str(), brightness, rampMs, dwellMs)) {
+      rejected++;
+    }
+  }
+  saveBrightnessPresets();
+  http->send(200, "text/plain",
+             rejected ? "Saved; rows with invalid names were skipped."
+                      : "Presets saved.");
 }